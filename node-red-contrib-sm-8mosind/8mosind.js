@@ -5,6 +5,15 @@ module.exports = function(RED) {
     const ALTERNATE_HW_ADD = 0x20;
     const OUT_REG = 0x01;
     const CFG_REG = 0x03;
+    const DIAG_3V3_REG = 0x04;
+    const DIAG_TEMP_REG = 0x06;
+    const PWM1_REG = 0x07;
+    const FREQ_REG = 0x1c;
+    const REVISION_REG = 0xab;
+    const IMAGE_SIZE = FREQ_REG + 2; // OUTPORT, diagnostics, PWM1..8 and frequency in one burst
+    const MIN_FREQ = 16;
+    const MAX_FREQ = 1000;
+    const POLL_SLACK = 10; // ms, a sample this early still counts for the node interval
     const mask = new ArrayBuffer(8);
     mask[0] = 0x01;
     mask[1] = 0x02;
@@ -14,6 +23,410 @@ module.exports = function(RED) {
     mask[5] = 0x20;
     mask[6] = 0x40;
     mask[7] = 0x80;
+    const BUS_NUMBER = 1;
+
+    // One FIFO per I2C bus, shared by all the nodes: the bus is accessed only
+    // with async calls, one job at a time, so the event loop never waits for it.
+    // Changes queued for the same board are merged in one OUTPORT write and
+    // every merged message is acknowledged after that write; reads queued for
+    // the same board share one burst read
+    function BusQueue(busNumber) {
+        this.busNumber = busNumber;
+        this.port = null;
+        this.users = 0;
+        this.jobs = [];
+        this.busy = false;
+        this.boards = {}; // stack level -> {hwAdd, extended}, found and initialized
+    }
+
+    BusQueue.prototype.acquire = function() {
+        this.users++;
+    };
+
+    BusQueue.prototype.release = function(done) {
+        var bus = this;
+        bus.users--;
+        if (bus.users > 0 || bus.busy || bus.port == null) {
+            done();
+            return;
+        }
+        var port = bus.port;
+        bus.port = null;
+        bus.boards = {};
+        port.close(function() { done(); });
+    };
+
+    // the latest job of this kind waiting for the board, a new one if there
+    // is none; a write is never merged across a read of the board queued
+    // after it, nor a read across a write, so a read sees exactly the writes
+    // requested before it
+    BusQueue.prototype.job = function(kind, stack) {
+        for (var i = this.jobs.length - 1; i >= 0; i--) {
+            var queued = this.jobs[i];
+            if (queued.stack != stack) {
+                continue;
+            }
+            if (queued.kind == kind) {
+                return queued;
+            }
+            if (queued.kind == "read" || kind == "read") {
+                break;
+            }
+        }
+        var job = {kind: kind, stack: stack, on: 0, off: 0, pwm: [null, null, null, null, null, null, null, null], freq: null, callbacks: []};
+        this.jobs.push(job);
+        return job;
+    };
+
+    // turn on the mosfets of "onBits" and off the ones of "offBits" (bit 0 = mosfet 1)
+    BusQueue.prototype.update = function(stack, onBits, offBits, callback) {
+        var job = this.job("update", stack);
+        job.on = (job.on & ~offBits) | onBits;
+        job.off = (job.off & ~onBits) | offBits;
+        job.callbacks.push(callback);
+        this.next();
+    };
+
+    // set the fill factors (percent) of the mosfets with a value other than
+    // null in "values" and, if not null, the pwm frequency
+    BusQueue.prototype.pwm = function(stack, values, freq, callback) {
+        var job = this.job("pwm", stack);
+        for (var i = 0; i < 8; i++) {
+            if (values[i] != null) {
+                job.pwm[i] = values[i];
+            }
+        }
+        if (freq != null) {
+            job.freq = freq;
+        }
+        job.callbacks.push(callback);
+        this.next();
+    };
+
+    // read the state of the board, callback(err, image)
+    BusQueue.prototype.read = function(stack, callback) {
+        this.job("read", stack).callbacks.push(callback);
+        this.next();
+    };
+
+    BusQueue.prototype.next = function() {
+        var bus = this;
+        if (bus.busy) {
+            return;
+        }
+        if (bus.jobs.length == 0) {
+            if (bus.users == 0 && bus.port != null) { // last node closed meanwhile
+                var port = bus.port;
+                bus.port = null;
+                bus.boards = {};
+                port.close(function() {});
+            }
+            return;
+        }
+        bus.busy = true;
+        var job = bus.jobs.shift();
+        var finish = function(err, result) {
+            bus.busy = false;
+            job.callbacks.forEach(function(cb) { cb(err, result); });
+            bus.next();
+        };
+        var run = function() {
+            var callback = bus.checked(job.stack, finish);
+            bus.detect(job.stack, function(err, board) {
+                if (err) {
+                    callback(err);
+                } else if (job.kind == "read") {
+                    bus.fetch(board, callback);
+                } else if (job.kind == "pwm") {
+                    bus.commitPwm(board, job, callback);
+                } else {
+                    bus.commit(board, job, callback);
+                }
+            });
+        };
+        if (bus.port != null) {
+            run();
+            return;
+        }
+        bus.port = I2C.open(bus.busNumber, function(err) {
+            if (err) {
+                bus.port = null;
+                finish(err);
+                return;
+            }
+            run();
+        });
+    };
+
+    // find the board, at the default address first, and make its pins outputs;
+    // done once, the address is kept until a transaction with the board fails
+    BusQueue.prototype.detect = function(stack, callback) {
+        var bus = this;
+        var port = this.port;
+        if (stack in bus.boards) {
+            callback(null, bus.boards[stack]);
+            return;
+        }
+        var found = function(err, hwAdd) {
+            if (err) {
+                callback(err);
+                return;
+            }
+            bus.boards[stack] = {hwAdd: hwAdd, extended: null};
+            callback(null, bus.boards[stack]);
+        };
+        var tryAdd = function(base, last) {
+            var hwAdd = base + (stack ^ 0x07);
+            port.readByte(hwAdd, CFG_REG, function(err, direction) {
+                if (err) {
+                    if (last) {
+                        found(err);
+                    } else {
+                        tryAdd(ALTERNATE_HW_ADD, true);
+                    }
+                    return;
+                }
+                if (direction == 0x00) {
+                    found(null, hwAdd);
+                    return;
+                }
+                port.writeByte(hwAdd, OUT_REG, 0xff, function(err) {
+                    if (err) {
+                        found(err);
+                        return;
+                    }
+                    port.writeByte(hwAdd, CFG_REG, 0x00, function(err) {
+                        found(err, hwAdd);
+                    });
+                });
+            });
+        };
+        tryAdd(DEFAULT_HW_ADD, false);
+    };
+
+    // forget the board after a failed transaction, the next job detects it again
+    BusQueue.prototype.checked = function(stack, callback) {
+        var bus = this;
+        return function(err) {
+            if (err) {
+                delete bus.boards[stack];
+            }
+            callback.apply(null, arguments);
+        };
+    };
+
+    BusQueue.prototype.commit = function(board, job, callback) {
+        var bus = this;
+        if (((job.on | job.off) & 0xff) == 0xff) { // the whole port, no need to read it
+            var port = 0;
+            for (var i = 0; i < 8; i++) {
+                if (job.off & (1 << i)) {
+                    port |= mask[i];//reverse logic
+                }
+            }
+            bus.port.writeByte(board.hwAdd, OUT_REG, port, callback);
+            return;
+        }
+        bus.port.readByte(board.hwAdd, OUT_REG, function(err, io) {
+            if (err) {
+                callback(err);
+                return;
+            }
+            var out = io;
+            for (var i = 0; i < 8; i++) {
+                if (job.on & (1 << i)) {
+                    out &= ~mask[i];//reverse logic
+                } else if (job.off & (1 << i)) {
+                    out |= mask[i];
+                }
+            }
+            if (out == io) {
+                callback(null);
+                return;
+            }
+            bus.port.writeByte(board.hwAdd, OUT_REG, out, callback);
+        });
+    };
+
+    // the extended boards are the ones answering the revision read, they have
+    // the pwm, the diagnostics and the RS485 port; the answer is cached with
+    // the address
+    BusQueue.prototype.probe = function(board, callback) {
+        if (board.extended != null) {
+            callback();
+            return;
+        }
+        this.port.readI2cBlock(board.hwAdd, REVISION_REG, 4, Buffer.alloc(4), function(err) {
+            board.extended = !err;
+            callback();
+        });
+    };
+
+    // the changed fill factors go in one block write, from the first to the
+    // last one changed; the span is read first only if it has gaps
+    BusQueue.prototype.commitPwm = function(board, job, callback) {
+        var bus = this;
+        var first = job.pwm.findIndex(function(v) { return v != null; });
+        var last = 7;
+        while (last >= 0 && job.pwm[last] == null) {
+            last--;
+        }
+        var buff = Buffer.alloc(2 * (last - first + 1));
+        var writeFreq = function(err) {
+            if (err || job.freq == null) {
+                callback(err);
+                return;
+            }
+            var freq = Buffer.alloc(2);
+            freq.writeUInt16LE(job.freq, 0);
+            bus.port.writeI2cBlock(board.hwAdd, FREQ_REG, 2, freq, function(err) { callback(err); });
+        };
+        var writePwm = function(err) {
+            if (err) {
+                callback(err);
+                return;
+            }
+            for (var i = first; i <= last; i++) {
+                if (job.pwm[i] != null) {
+                    buff.writeUInt16LE(Math.round(job.pwm[i] * 10), 2 * (i - first));
+                }
+            }
+            bus.port.writeI2cBlock(board.hwAdd, PWM1_REG + 2 * first, buff.length, buff, writeFreq);
+        };
+        bus.probe(board, function() {
+            if (!board.extended) {
+                callback(new Error("The card has no pwm"));
+            } else if (first < 0) {
+                writeFreq(null);
+            } else if (job.pwm.slice(first, last + 1).indexOf(null) >= 0) {
+                bus.port.readI2cBlock(board.hwAdd, PWM1_REG + 2 * first, buff.length, buff, writePwm);
+            } else {
+                writePwm(null);
+            }
+        });
+    };
+
+    // the image of a plain I/O expander has only the mosfets, the extended
+    // boards add the pwm, the frequency and the diagnostics
+    BusQueue.prototype.fetch = function(board, callback) {
+        var bus = this;
+        var decode = function(out) {
+            var mosfets = 0;
+            for (var i = 0; i < 8; i++) {
+                if ((out & mask[i]) == 0) {//reverse logic
+                    mosfets |= 1 << i;
+                }
+            }
+            return {mosfets: mosfets};
+        };
+        if (board.extended == null) {
+            bus.probe(board, function() { bus.fetch(board, callback); });
+            return;
+        }
+        if (!board.extended) {
+            bus.port.readByte(board.hwAdd, OUT_REG, function(err, out) {
+                callback(err, err ? null : decode(out));
+            });
+            return;
+        }
+        bus.port.readI2cBlock(board.hwAdd, 0, IMAGE_SIZE, Buffer.alloc(IMAGE_SIZE), function(err, bytes, buff) {
+            if (err) {
+                callback(err);
+                return;
+            }
+            var image = decode(buff[OUT_REG]);
+            image.pwm = [];
+            for (var i = 0; i < 8; i++) {
+                image.pwm.push(buff.readUInt16LE(PWM1_REG + 2 * i) / 10);
+            }
+            image.frequency = buff.readUInt16LE(FREQ_REG);
+            image.diag = {
+                v3v3: buff.readUInt16LE(DIAG_3V3_REG) / 1000,
+                temperature: buff.readInt8(DIAG_TEMP_REG)
+            };
+            callback(null, image);
+        });
+    };
+
+    var buses = {};
+
+    function getBus(busNumber) {
+        if (!(busNumber in buses)) {
+            buses[busNumber] = new BusQueue(busNumber);
+        }
+        return buses[busNumber];
+    }
+
+    // One poller per board, shared by all the read nodes of the board: it reads
+    // the board at the shortest interval of its subscribers and hands every
+    // image to all of them
+    function Poller(bus, stack) {
+        this.bus = bus;
+        this.stack = stack;
+        this.subscribers = [];
+        this.interval = 0;
+        this.timer = null;
+        this.reading = false;
+    }
+
+    Poller.prototype.subscribe = function(sub) {
+        this.subscribers.push(sub);
+        this.schedule();
+    };
+
+    Poller.prototype.unsubscribe = function(sub) {
+        var i = this.subscribers.indexOf(sub);
+        if (i >= 0) {
+            this.subscribers.splice(i, 1);
+        }
+        this.schedule();
+        if (this.subscribers.length == 0) {
+            delete pollers[this.bus.busNumber + ":" + this.stack];
+        }
+    };
+
+    Poller.prototype.schedule = function() {
+        var interval = 0;
+        this.subscribers.forEach(function(sub) {
+            if (interval == 0 || sub.interval < interval) {
+                interval = sub.interval;
+            }
+        });
+        if (interval == this.interval) {
+            return;
+        }
+        if (this.timer != null) {
+            clearInterval(this.timer);
+            this.timer = null;
+        }
+        this.interval = interval;
+        if (interval > 0) {
+            this.timer = setInterval(this.poll.bind(this), interval);
+        }
+    };
+
+    Poller.prototype.poll = function() {
+        var poller = this;
+        if (poller.reading) { // the bus is slower than the interval, skip a sample
+            return;
+        }
+        poller.reading = true;
+        poller.bus.read(poller.stack, function(err, image) {
+            poller.reading = false;
+            poller.subscribers.slice().forEach(function(sub) { sub.sample(err, image); });
+        });
+    };
+
+    var pollers = {};
+
+    function getPoller(bus, stack) {
+        var key = bus.busNumber + ":" + stack;
+        if (!(key in pollers)) {
+            pollers[key] = new Poller(bus, stack);
+        }
+        return pollers[key];
+    }
+
     // The mosfet Node
     function MosfetNode(n) {
         RED.nodes.createNode(this, n);
@@ -23,8 +436,11 @@ module.exports = function(RED) {
         this.payloadType = n.payloadType;
         var node = this;
  
-        node.port = I2C.openSync( 1 );
-        node.on("input", function(msg) {
+        node.bus = getBus(BUS_NUMBER);
+        node.bus.acquire();
+        node.on("input", function(msg, send, done) {
+            send = send || function() { node.send.apply(node, arguments); };
+            done = done || function(err) { if (err) { node.error(err, msg); } };
             var myPayload;
             var stack = node.stack;
             if (isNaN(stack)) stack = msg.stack;
@@ -35,38 +451,21 @@ module.exports = function(RED) {
             //var buffcount = parseInt(node.count);
             if (isNaN(stack + 1)) {
                 this.status({fill:"red",shape:"ring",text:"Stack level ("+stack+") value is missing or incorrect"});
+                done();
                 return;
             } else if (isNaN(mosfet) ) {
                 this.status({fill:"red",shape:"ring",text:"Mosfet number  ("+mosfet+") value is missing or incorrect"});
+                done();
                 return;
             } else {
                 this.status({});
             }
-            var hwAdd = DEFAULT_HW_ADD;
-            var found = 1;
             if(stack < 0){
                 stack = 0;
             }
             if(stack > 7){
               stack = 7;
             }
-            //check the type of io_expander
-            hwAdd += stack ^ 0x07;
-            var direction = 0xaa;
-            try{
-                direction = node.port.readByteSync(hwAdd, CFG_REG );
-            }catch(err) {
-                hwAdd = ALTERNATE_HW_ADD;
-                hwAdd += stack ^ 0x07;
-                try{
-                    direction = node.port.readByteSync(hwAdd, CFG_REG );
-                }catch(err) {
-                    found = 0;
-                    this.error(err,msg);
-                }
-            }
-            
-            if(1 == found){
             try {
                 if (this.payloadType == null) {
                     myPayload = this.payload;
@@ -75,44 +474,248 @@ module.exports = function(RED) {
                 } else {
                     myPayload = RED.util.evaluateNodeProperty(this.payload, this.payloadType, this,msg);
                 }
-                //node.log('Direction ' + String(direction));   
-                if(direction != 0x00){
-                    node.port.writeByteSync(hwAdd, OUT_REG, 0x00);
-                    //node.log('First update output');   
-                    node.port.writeByteSync(hwAdd, CFG_REG, 0x00);
-                    //node.log('First update direction');  
+            } catch(err) {
+                done(err);
+                return;
+            }
+            if(mosfet < 1){
+              mosfet = 1;
+            }
+            if(mosfet > 8){
+              mosfet = 8;
+            }
+            var bit = 1 << (mosfet - 1);
+            var on = !(myPayload == null || myPayload == false || myPayload == 0 || myPayload == 'off');
+            node.bus.update(stack, on ? bit : 0, on ? 0 : bit, function(err) {
+                if (err) {
+                    done(err);
+                } else {
+                    send(msg);
+                    done();
                 }
-                var mosfetVal = 0;    
-                mosfetVal = node.port.readByteSync(hwAdd, OUT_REG);
-                //node.log('Mosfets ' + String(mosfetVal));
-                if(mosfet < 1){
-                  mosfet = 1;
+            });
+        });
+
+        node.on("close", function(done) {
+            node.bus.release(done);
+        });
+    }
+    RED.nodes.registerType("8mosind", MosfetNode);
+
+    // the stack level of the node, or of the message if the node has none
+    function msgStack(node, msg) {
+        var stack = node.stack;
+        if (isNaN(stack)) stack = msg.stack;
+        stack = parseInt(stack);
+        if (isNaN(stack) || stack < 0 || stack > 7) {
+            node.status({fill:"red",shape:"ring",text:"Stack level ("+stack+") value is missing or incorrect"});
+            return null;
+        }
+        return stack;
+    }
+
+    // The read Node: the state of one mosfet or of the whole board, on every
+    // input message and, with an interval set, periodically
+    function MosfetReadNode(n) {
+        RED.nodes.createNode(this, n);
+        this.stack = parseInt(n.stack);
+        this.mosfet = parseInt(n.mosfet);
+        this.interval = parseInt(n.interval);
+        this.change = n.change == true;
+        var node = this;
+        var last = null;
+        var lastTime = 0;
+        var failed = false;
+
+        var format = function(image) {
+            if (node.mosfet >= 1 && node.mosfet <= 8) {
+                return (image.mosfets >> (node.mosfet - 1)) & 1;
+            }
+            return image;
+        };
+
+        node.bus = getBus(BUS_NUMBER);
+        node.bus.acquire();
+        node.poller = null;
+        if (!isNaN(node.stack) && node.stack >= 0 && node.stack <= 7 && node.interval > 0) {
+            node.poller = getPoller(node.bus, node.stack);
+            node.sub = {
+                interval: node.interval,
+                sample: function(err, image) {
+                    if (err) {
+                        if (!failed) { // once, not at every poll
+                            node.error(err);
+                        }
+                        failed = true;
+                        node.status({fill:"red",shape:"ring",text:"Read failed"});
+                        return;
+                    }
+                    if (failed) {
+                        failed = false;
+                        node.status({});
+                    }
+                    var now = Date.now();
+                    if (now - lastTime < node.interval - POLL_SLACK) { // the poller serves a faster node
+                        return;
+                    }
+                    var payload = format(image);
+                    var text = JSON.stringify(payload);
+                    if (node.change && text === last) {
+                        return;
+                    }
+                    last = text;
+                    lastTime = now;
+                    node.send({topic: "8mosind/" + node.stack, stack: node.stack, payload: payload});
                 }
-                if(mosfet > 8){
-                  mosfet = 8;
+            };
+            node.poller.subscribe(node.sub);
+        }
+
+        node.on("input", function(msg, send, done) {
+            send = send || function() { node.send.apply(node, arguments); };
+            done = done || function(err) { if (err) { node.error(err, msg); } };
+            var stack = msgStack(node, msg);
+            if (stack == null) {
+                done();
+                return;
+            }
+            node.bus.read(stack, function(err, image) {
+                if (err) {
+                    done(err);
+                    return;
                 }
-                mosfet-= 1;//zero based
-                if (myPayload == null || myPayload == false || myPayload == 0 || myPayload == 'off') {
-                  mosfetVal |= mask[mosfet];//reverse logic
+                msg.stack = stack;
+                msg.payload = format(image);
+                send(msg);
+                done();
+            });
+        });
+
+        node.on("close", function(done) {
+            if (node.poller != null) {
+                node.poller.unsubscribe(node.sub);
+            }
+            node.bus.release(done);
+        });
+    }
+    RED.nodes.registerType("8mosind-read", MosfetReadNode);
+
+    // The port Node: all the mosfets of a card from one message, one OUTPORT
+    // write; msg.payload is a mask (bit 0 = mosfet 1) or an array of 8 states
+    function MosfetPortNode(n) {
+        RED.nodes.createNode(this, n);
+        this.stack = parseInt(n.stack);
+        var node = this;
+
+        node.bus = getBus(BUS_NUMBER);
+        node.bus.acquire();
+        node.on("input", function(msg, send, done) {
+            send = send || function() { node.send.apply(node, arguments); };
+            done = done || function(err) { if (err) { node.error(err, msg); } };
+            var stack = msgStack(node, msg);
+            if (stack == null) {
+                done();
+                return;
+            }
+            var bits = msg.payload;
+            if (Array.isArray(bits) && bits.length == 8) {
+                bits = bits.reduce(function(acc, v, i) {
+                    return (v && v != 'off') ? acc | (1 << i) : acc;
+                }, 0);
+            } else {
+                bits = parseInt(bits);
+            }
+            if (isNaN(bits) || bits < 0 || bits > 255) {
+                node.status({fill:"red",shape:"ring",text:"Payload must be a mask 0..255 or an array of 8 states"});
+                done();
+                return;
+            }
+            node.status({});
+            node.bus.update(stack, bits, ~bits & 0xff, function(err) {
+                if (err) {
+                    done(err);
                 } else {
-                  mosfetVal &= ~mask[mosfet];
+                    send(msg);
+                    done();
                 }
-                node.port.writeByte(hwAdd, OUT_REG, mosfetVal,  function(err) {
-                    if (err) { node.error(err, msg);
-                    } else {
-                      node.send(msg);
-                    }
-                });
-            } catch(err) {
-                this.error(err,msg);
+            });
+        });
+
+        node.on("close", function(done) {
+            node.bus.release(done);
+        });
+    }
+    RED.nodes.registerType("8mosind-port", MosfetPortNode);
+
+    // The pwm Node: the fill factor (percent) of one mosfet, or of all from an
+    // array of 8 in one block write, and the pwm frequency (msg.frequency)
+    function MosfetPwmNode(n) {
+        RED.nodes.createNode(this, n);
+        this.stack = parseInt(n.stack);
+        this.mosfet = parseInt(n.mosfet);
+        this.frequency = parseInt(n.frequency);
+        var node = this;
+
+        node.bus = getBus(BUS_NUMBER);
+        node.bus.acquire();
+        node.on("input", function(msg, send, done) {
+            send = send || function() { node.send.apply(node, arguments); };
+            done = done || function(err) { if (err) { node.error(err, msg); } };
+            var stack = msgStack(node, msg);
+            if (stack == null) {
+                done();
+                return;
+            }
+            var mosfet = node.mosfet;
+            if (isNaN(mosfet)) mosfet = parseInt(msg.mosfet);
+            var freq = msg.frequency != null ? parseInt(msg.frequency) : node.frequency;
+            if (isNaN(freq)) {
+                freq = null;
+            } else if (freq < MIN_FREQ || freq > MAX_FREQ) {
+                node.status({fill:"red",shape:"ring",text:"Frequency out of range ["+MIN_FREQ+".."+MAX_FREQ+"]"});
+                done();
+                return;
             }
-          }
+            var values = [null, null, null, null, null, null, null, null];
+            var clamp = function(v) {
+                v = parseFloat(v);
+                return isNaN(v) ? null : Math.min(Math.max(v, 0), 100);
+            };
+            if (Array.isArray(msg.payload)) {
+                if (msg.payload.length != 8) {
+                    node.status({fill:"red",shape:"ring",text:"The payload array must have 8 values"});
+                    done();
+                    return;
+                }
+                values = msg.payload.map(clamp);
+            } else if (msg.payload != null && msg.payload !== "") {
+                if (isNaN(mosfet) || mosfet < 1 || mosfet > 8) {
+                    node.status({fill:"red",shape:"ring",text:"Mosfet number  ("+mosfet+") value is missing or incorrect"});
+                    done();
+                    return;
+                }
+                values[mosfet - 1] = clamp(msg.payload);
+            }
+            if (values.every(function(v) { return v == null; }) && freq == null) {
+                node.status({fill:"red",shape:"ring",text:"Nothing to set"});
+                done();
+                return;
+            }
+            node.status({});
+            node.bus.pwm(stack, values, freq, function(err) {
+                if (err) {
+                    done(err);
+                } else {
+                    send(msg);
+                    done();
+                }
+            });
         });
 
-        node.on("close", function() {
-            node.port.closeSync();
+        node.on("close", function(done) {
+            node.bus.release(done);
         });
     }
-    RED.nodes.registerType("8mosind", MosfetNode);
+    RED.nodes.registerType("8mosind-pwm", MosfetPwmNode);
 
 }
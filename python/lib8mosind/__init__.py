@@ -1,4 +1,18 @@
-import smbus2
+import threading
+
+try:
+    import smbus2
+except ImportError:
+    smbus2 = None
+
+# Native binding of libmosind: persistent handles, no probing on every call.
+# Without it every function opens the bus and checks the board by itself
+try:
+    from lib8mosind import _mosind
+except ImportError:
+    _mosind = None
+
+NATIVE_BUS = 1  # libmosind always drives /dev/i2c-1, other buses use smbus2
 
 # bus = smbus2.SMBus(1)    # 0 = /dev/i2c-0 (port I2C0), 1 = /dev/i2c-1 (port I2C1)
 
@@ -15,6 +29,30 @@ mosfetMaskRemap = [0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80]
 mosfetChRemap = [0, 1, 2, 3, 4, 5, 6, 7]
 
 
+_handles = {}
+
+
+def _handle(stack):
+    if stack < 0 or stack > 7:
+        raise ValueError('Invalid stack level')
+    h = _handles.get(stack)
+    if h is None:
+        try:
+            h = _mosind.Handle(stack)
+        except _mosind.Error:
+            raise ValueError('8-mosfets card not detected!')
+        _handles[stack] = h
+    return h
+
+
+def _native(stack, op, msg='8-mosfets card not detected!'):
+    h = _handle(stack)
+    try:
+        return op(h)
+    except _mosind.Error:
+        raise ValueError(msg)
+
+
 def mosfetToIO(mosfet):
     val = 0
     for i in range(0, 8):
@@ -78,6 +116,8 @@ def set(stack, mosfet, value):
         raise ValueError('Invalid mosfet number')
     if mosfet > 8:
         raise ValueError('Invalid mosfet number')
+    if _mosind is not None:
+        return _native(stack, lambda h: h.set_channel(mosfet, value != 0))
     try:
         bus = smbus2.SMBus(1)
         oldVal = check_a(bus, stack)
@@ -104,6 +144,9 @@ def set_pwm(stack, mosfet, value):
         value = 100;
     if value < 0:
         value = 0
+    if _mosind is not None:
+        return _native(stack, lambda h: h.pwm_write(mosfet, int(value * 10)),
+                       '8-mosfets card not detected or does not support PWM feature!')
     try:
         bus = smbus2.SMBus(1)
         check_a(bus, stack)
@@ -118,6 +161,9 @@ def get_pwm(stack, mosfet):
         raise ValueError('Invalid mosfet number')
     if mosfet > 8:
         raise ValueError('Invalid mosfet number')
+    if _mosind is not None:
+        return _native(stack, lambda h: h.pwm_read(mosfet),
+                       '8-mosfets card not detected or does not support PWM feature!') / 10
     try:
         bus = smbus2.SMBus(1)
         check_a(bus, stack)
@@ -133,6 +179,8 @@ def set_all(stack, value):
         raise ValueError('Invalid mosfet value')
     if value < 0:
         raise ValueError('Invalid mosfet value')
+    if _mosind is not None:
+        return _native(stack, lambda h: h.set_mask(value))
     bus = smbus2.SMBus(1)
     oldVal = check_a(bus, stack)
     value = mosfetToIO(value)
@@ -149,6 +197,8 @@ def get(stack, mosfet):
         raise ValueError('Invalid mosfet number')
     if mosfet > 8:
         raise ValueError('Invalid mosfet number')
+    if _mosind is not None:
+        return _native(stack, lambda h: h.get_channel(mosfet))
     bus = smbus2.SMBus(1)
     val = check_a(bus, stack)
     val = IOToMosfet(val)
@@ -161,8 +211,250 @@ def get(stack, mosfet):
 
 
 def get_all(stack):
+    if _mosind is not None:
+        return _native(stack, lambda h: h.get_mask())
     bus = smbus2.SMBus(1)
     val = check_a(bus, stack)
     val = IOToMosfet(val)
     bus.close()
-    return val
\ No newline at end of file
+    return val
+
+
+def set_pwm_all(stack, values):
+    if len(values) != 8:
+        raise ValueError('Invalid number of pwm values')
+    raw = [int(min(max(v, 0), 100) * 10) for v in values]
+    if _mosind is not None:
+        return _native(stack, lambda h: h.pwm_write_all(raw),
+                       '8-mosfets card not detected or does not support PWM feature!')
+    buff = []
+    for v in raw:
+        buff += [v & 0xff, v >> 8]
+    try:
+        bus = smbus2.SMBus(1)
+        check_a(bus, stack)
+        bus.write_i2c_block_data(devAdd, MOSFET8_MEM_PWM1, buff)
+    except Exception as e:
+        bus.close()
+        raise ValueError('8-mosfets card not detected or does not support PWM feature!')
+    bus.close()
+
+
+def get_pwm_all(stack):
+    if _mosind is not None:
+        raw = _native(stack, lambda h: h.pwm_read_all(),
+                      '8-mosfets card not detected or does not support PWM feature!')
+        return [v / 10 for v in raw]
+    try:
+        bus = smbus2.SMBus(1)
+        check_a(bus, stack)
+        buff = bytearray(bus.read_i2c_block_data(devAdd, MOSFET8_MEM_PWM1, 16))
+    except Exception as e:
+        bus.close()
+        raise ValueError('8-mosfets card not detected or does not support PWM feature!')
+    bus.close()
+    return [(buff[2 * i] + 256 * buff[2 * i + 1]) / 10 for i in range(0, 8)]
+
+
+class Board(object):
+    """One 8-MOSFETS card, for services that drive the outputs often.
+
+    The address is resolved and the card initialized once, the bus stays
+    open until close(). The state of the mosfets is kept in a shadow, so a
+    change is one OUTPORT write; the shadow assumes this object is the only
+    writer of the card, refresh() reads the card again.
+
+    Inside a "with board:" block the changes are queued and committed on exit:
+    one OUTPORT write for all the mosfets and one PWM write for all the fill
+    factors. The block holds the board lock, other threads wait for the commit.
+    """
+
+    def __init__(self, stack, bus=1):
+        if stack < 0 or stack > 7:
+            raise ValueError('Invalid stack level')
+        self.stack = stack
+        self._lock = threading.RLock()
+        self._depth = 0
+        self._queued = None  # mosfets state to commit
+        self._queuedPwm = {}  # channel: per mille
+        self._pwm = None  # per mille shadow, read on first use
+        self._h = None
+        self._bus = None
+        self._add = None
+        if _mosind is not None and bus == NATIVE_BUS:
+            self._h = _handle(stack)
+        else:
+            if smbus2 is None:
+                raise ValueError('smbus2 is needed for the I2C bus %d' % bus)
+            self._bus = smbus2.SMBus(bus)
+            for base in (DEVICE_ADDRESS, ALTERNATE_DEVICE_ADDRESS):
+                try:
+                    check(self._bus, base + (0x07 ^ stack))
+                    self._add = base + (0x07 ^ stack)
+                    break
+                except Exception:
+                    pass
+            if self._add is None:
+                self._bus.close()
+                raise ValueError('8-mosfets card not detected!')
+        self.refresh()
+
+    def close(self):
+        with self._lock:
+            if self._bus is not None:
+                self._bus.close()
+                self._bus = None
+            self._h = None
+
+    def refresh(self):
+        """Read the mosfets state from the card, return it"""
+        with self._lock:
+            if self._h is not None:
+                self._mask = self._h.get_mask()
+            else:
+                self._mask = IOToMosfet(self._bus.read_byte_data(self._add, MOSFET8_OUTPORT_REG_ADD))
+            self._pwm = None
+            return self._mask
+
+    def _writeMask(self, mask):
+        try:
+            if self._h is not None:
+                self._h.set_mask(mask)
+            else:
+                self._bus.write_byte_data(self._add, MOSFET8_OUTPORT_REG_ADD, mosfetToIO(mask))
+        except Exception:
+            self._mask = None  # unknown after a failed write, read on next use
+            raise
+        self._mask = mask
+
+    def _writePwm(self, pwm):
+        first = min(pwm)
+        last = max(pwm)
+        if self._pwm is None and first != last:
+            self._readPwm()
+        if self._h is not None and first == last:
+            self._h.pwm_write(first, pwm[first])
+        elif self._h is not None:
+            values = list(self._pwm)
+            for ch, val in pwm.items():
+                values[ch - 1] = val
+            self._h.pwm_write_all(values)
+        else:
+            # the span from the first to the last changed channel, one block write
+            buff = []
+            for ch in range(first, last + 1):
+                val = pwm.get(ch, self._pwm[ch - 1] if self._pwm is not None else 0)
+                buff += [val & 0xff, val >> 8]
+            self._bus.write_i2c_block_data(self._add, MOSFET8_MEM_PWM1 + 2 * (first - 1), buff)
+        if self._pwm is not None:
+            for ch, val in pwm.items():
+                self._pwm[ch - 1] = val
+
+    def _readPwm(self):
+        if self._h is not None:
+            self._pwm = self._h.pwm_read_all()
+        else:
+            buff = bytearray(self._bus.read_i2c_block_data(self._add, MOSFET8_MEM_PWM1, 16))
+            self._pwm = [buff[2 * i] + 256 * buff[2 * i + 1] for i in range(0, 8)]
+        return self._pwm
+
+    def _current(self):
+        if self._queued is not None:
+            return self._queued
+        if self._mask is None:
+            self.refresh()
+        return self._mask
+
+    def _apply(self, mask):
+        if self._depth > 0:
+            self._queued = mask
+        elif mask != self._current():
+            self._writeMask(mask)
+
+    def set_many(self, changes):
+        """Set several mosfets, {mosfet: 0/1}, in one OUTPORT write"""
+        with self._lock:
+            mask = self._current()
+            for mosfet, value in changes.items():
+                if mosfet < 1 or mosfet > 8:
+                    raise ValueError('Invalid mosfet number')
+                if value:
+                    mask |= 1 << (mosfet - 1)
+                else:
+                    mask &= ~(1 << (mosfet - 1))
+            self._apply(mask)
+
+    def set(self, mosfet, value):
+        self.set_many({mosfet: value})
+
+    def set_all(self, value):
+        if value < 0 or value > 255:
+            raise ValueError('Invalid mosfet value')
+        with self._lock:
+            self._apply(value)
+
+    def get(self, mosfet):
+        if mosfet < 1 or mosfet > 8:
+            raise ValueError('Invalid mosfet number')
+        return (self.get_all() >> (mosfet - 1)) & 1
+
+    def get_all(self):
+        """The mosfets state, from the shadow or the queued changes"""
+        with self._lock:
+            return self._current()
+
+    def pwm(self, mosfet, value):
+        """Set one fill factor [0..100]"""
+        self.pwm_many({mosfet: value})
+
+    def pwm_many(self, changes):
+        """Set several fill factors, {mosfet: 0..100}, in one PWM write"""
+        pwm = {}
+        for mosfet, value in changes.items():
+            if mosfet < 1 or mosfet > 8:
+                raise ValueError('Invalid mosfet number')
+            pwm[mosfet] = int(min(max(value, 0), 100) * 10)
+        with self._lock:
+            if self._depth > 0:
+                self._queuedPwm.update(pwm)
+            elif pwm:
+                self._writePwm(pwm)
+
+    def pwm_all(self, values):
+        """Set the eight fill factors [0..100] in one PWM write"""
+        if len(values) != 8:
+            raise ValueError('Invalid number of pwm values')
+        self.pwm_many(dict((i + 1, v) for i, v in enumerate(values)))
+
+    def get_pwm_all(self):
+        """Read the eight fill factors [0..100] in one transfer"""
+        with self._lock:
+            return [v / 10 for v in self._readPwm()]
+
+    def commit(self):
+        """Write the queued changes now, one transaction per register group"""
+        with self._lock:
+            queued, self._queued = self._queued, None
+            queuedPwm, self._queuedPwm = self._queuedPwm, {}
+            if queued is not None and queued != self._mask:
+                self._writeMask(queued)
+            if queuedPwm:
+                self._writePwm(queuedPwm)
+
+    def __enter__(self):
+        self._lock.acquire()
+        self._depth += 1
+        return self
+
+    def __exit__(self, exc_type, exc, tb):
+        try:
+            self._depth -= 1
+            if self._depth == 0:
+                if exc_type is None:
+                    self.commit()
+                else:
+                    self._queued = None
+                    self._queuedPwm = {}
+        finally:
+            self._lock.release()
+        return False
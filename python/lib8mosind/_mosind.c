@@ -0,0 +1,496 @@
+/*
+ * _mosind.c:
+ *	Python binding of libmosind: one persistent handle per board, the bus
+ *	stays open and the board is detected once. The GIL is released during
+ *	every bus operation, the calls into the library are serialized by a lock
+ *
+ *	Copyright (c) 2016-2023 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ *	Author: Alexandru Burcea
+ ***********************************************************************
+ */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <pthread.h>
+#include <mosind.h>
+
+static PyObject *gError = NULL;
+
+// libmosind keeps per process state, one call at a time
+static pthread_mutex_t gLock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct
+{
+	PyObject_HEAD
+	mosind_t *h;
+	int stack;
+} HandleObject;
+
+/*
+ * Run "expr" without the GIL and with the library lock, "ret" gets its result
+ * and "err" the library error code
+ */
+#define MOSIND_CALL(ret, err, expr) \
+	do \
+	{ \
+		Py_BEGIN_ALLOW_THREADS \
+		pthread_mutex_lock(&gLock); \
+		ret = (expr); \
+		err = mosind_last_error(); \
+		pthread_mutex_unlock(&gLock); \
+		Py_END_ALLOW_THREADS \
+	} while (0)
+
+static PyObject* raiseError(int err)
+{
+	PyObject *exc = Py_BuildValue("(is)", err, mosind_strerror(err));
+
+	if (NULL != exc)
+	{
+		PyErr_SetObject(gError, exc);
+		Py_DECREF(exc);
+	}
+	return NULL;
+}
+
+static int handleCheck(HandleObject *self)
+{
+	if (NULL == self->h)
+	{
+		PyErr_SetString(PyExc_ValueError, "board handle is closed");
+		return -1;
+	}
+	return 0;
+}
+
+static int Handle_init(HandleObject *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"stack", NULL};
+	mosind_t *h = NULL;
+	int stack = 0;
+	int err = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "i", kwlist, &stack))
+	{
+		return -1;
+	}
+	if ( (stack < 0) || (stack >= MOSIND_STACK_LEVELS))
+	{
+		PyErr_SetString(PyExc_ValueError, "Invalid stack level");
+		return -1;
+	}
+	MOSIND_CALL(h, err, mosind_open(stack));
+	if (NULL == h)
+	{
+		raiseError(err);
+		return -1;
+	}
+	if (NULL != self->h) // __init__ called again
+	{
+		mosind_close(self->h);
+	}
+	self->h = h;
+	self->stack = stack;
+	return 0;
+}
+
+static void Handle_dealloc(HandleObject *self)
+{
+	if (NULL != self->h)
+	{
+		pthread_mutex_lock(&gLock);
+		mosind_close(self->h);
+		pthread_mutex_unlock(&gLock);
+		self->h = NULL;
+	}
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* Handle_close(HandleObject *self, PyObject *unused)
+{
+	(void)unused;
+	if (NULL != self->h)
+	{
+		pthread_mutex_lock(&gLock);
+		mosind_close(self->h);
+		pthread_mutex_unlock(&gLock);
+		self->h = NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject* Handle_set_mask(HandleObject *self, PyObject *args)
+{
+	int mask = 0;
+	int ret;
+	int err;
+
+	if ( (handleCheck(self) < 0) || !PyArg_ParseTuple(args, "i", &mask))
+	{
+		return NULL;
+	}
+	if ( (mask < 0) || (mask > 255))
+	{
+		PyErr_SetString(PyExc_ValueError, "Invalid mosfet value");
+		return NULL;
+	}
+	MOSIND_CALL(ret, err, mosind_set_mask(self->h, (uint8_t)mask));
+	if (ret != 0)
+	{
+		return raiseError(err);
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject* Handle_get_mask(HandleObject *self, PyObject *unused)
+{
+	uint8_t mask = 0;
+	int ret;
+	int err;
+
+	(void)unused;
+	if (handleCheck(self) < 0)
+	{
+		return NULL;
+	}
+	MOSIND_CALL(ret, err, mosind_get_mask(self->h, &mask));
+	if (ret != 0)
+	{
+		return raiseError(err);
+	}
+	return PyLong_FromLong(mask);
+}
+
+static PyObject* Handle_set_channel(HandleObject *self, PyObject *args)
+{
+	int channel = 0;
+	int on = 0;
+	int ret;
+	int err;
+
+	if ( (handleCheck(self) < 0) || !PyArg_ParseTuple(args, "ip", &channel, &on))
+	{
+		return NULL;
+	}
+	MOSIND_CALL(ret, err, mosind_set_channel(self->h, channel, on));
+	if (ret != 0)
+	{
+		return raiseError(err);
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject* Handle_get_channel(HandleObject *self, PyObject *args)
+{
+	int channel = 0;
+	int on = 0;
+	int ret;
+	int err;
+
+	if ( (handleCheck(self) < 0) || !PyArg_ParseTuple(args, "i", &channel))
+	{
+		return NULL;
+	}
+	MOSIND_CALL(ret, err, mosind_get_channel(self->h, channel, &on));
+	if (ret != 0)
+	{
+		return raiseError(err);
+	}
+	return PyLong_FromLong(on);
+}
+
+static PyObject* Handle_pwm_write(HandleObject *self, PyObject *args)
+{
+	int channel = 0;
+	int perMille = 0;
+	int ret;
+	int err;
+
+	if ( (handleCheck(self) < 0)
+		|| !PyArg_ParseTuple(args, "ii", &channel, &perMille))
+	{
+		return NULL;
+	}
+	MOSIND_CALL(ret, err, mosind_pwm_write(self->h, channel, perMille));
+	if (ret != 0)
+	{
+		return raiseError(err);
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject* Handle_pwm_read(HandleObject *self, PyObject *args)
+{
+	int channel = 0;
+	int perMille = 0;
+	int ret;
+	int err;
+
+	if ( (handleCheck(self) < 0) || !PyArg_ParseTuple(args, "i", &channel))
+	{
+		return NULL;
+	}
+	MOSIND_CALL(ret, err, mosind_pwm_read(self->h, channel, &perMille));
+	if (ret != 0)
+	{
+		return raiseError(err);
+	}
+	return PyLong_FromLong(perMille);
+}
+
+static PyObject* Handle_pwm_write_all(HandleObject *self, PyObject *args)
+{
+	uint16_t perMille[MOSIND_CHANNELS];
+	PyObject *seq = NULL;
+	PyObject *fast = NULL;
+	long val;
+	int ret;
+	int err;
+	int i;
+
+	if ( (handleCheck(self) < 0) || !PyArg_ParseTuple(args, "O", &seq))
+	{
+		return NULL;
+	}
+	fast = PySequence_Fast(seq, "pwm_write_all expects a sequence of 8 values");
+	if (NULL == fast)
+	{
+		return NULL;
+	}
+	if (PySequence_Fast_GET_SIZE(fast) != MOSIND_CHANNELS)
+	{
+		Py_DECREF(fast);
+		PyErr_SetString(PyExc_ValueError, "pwm_write_all expects 8 values");
+		return NULL;
+	}
+	for (i = 0; i < MOSIND_CHANNELS; i++)
+	{
+		val = PyLong_AsLong(PySequence_Fast_GET_ITEM(fast, i));
+		if ( (val == -1) && PyErr_Occurred())
+		{
+			Py_DECREF(fast);
+			return NULL;
+		}
+		if ( (val < 0) || (val > MOSIND_PWM_MAX))
+		{
+			Py_DECREF(fast);
+			PyErr_SetString(PyExc_ValueError, "Invalid pwm value [0..1000]");
+			return NULL;
+		}
+		perMille[i] = (uint16_t)val;
+	}
+	Py_DECREF(fast);
+	MOSIND_CALL(ret, err, mosind_pwm_write_all(self->h, perMille));
+	if (ret != 0)
+	{
+		return raiseError(err);
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject* Handle_pwm_read_all(HandleObject *self, PyObject *unused)
+{
+	uint16_t perMille[MOSIND_CHANNELS];
+	PyObject *list = NULL;
+	int ret;
+	int err;
+	int i;
+
+	(void)unused;
+	if (handleCheck(self) < 0)
+	{
+		return NULL;
+	}
+	MOSIND_CALL(ret, err, mosind_pwm_read_all(self->h, perMille));
+	if (ret != 0)
+	{
+		return raiseError(err);
+	}
+	list = PyList_New(MOSIND_CHANNELS);
+	if (NULL == list)
+	{
+		return NULL;
+	}
+	for (i = 0; i < MOSIND_CHANNELS; i++)
+	{
+		PyList_SET_ITEM(list, i, PyLong_FromLong(perMille[i]));
+	}
+	return list;
+}
+
+static PyObject* Handle_freq_write(HandleObject *self, PyObject *args)
+{
+	int hz = 0;
+	int ret;
+	int err;
+
+	if ( (handleCheck(self) < 0) || !PyArg_ParseTuple(args, "i", &hz))
+	{
+		return NULL;
+	}
+	MOSIND_CALL(ret, err, mosind_freq_write(self->h, hz));
+	if (ret != 0)
+	{
+		return raiseError(err);
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject* Handle_freq_read(HandleObject *self, PyObject *unused)
+{
+	int hz = 0;
+	int ret;
+	int err;
+
+	(void)unused;
+	if (handleCheck(self) < 0)
+	{
+		return NULL;
+	}
+	MOSIND_CALL(ret, err, mosind_freq_read(self->h, &hz));
+	if (ret != 0)
+	{
+		return raiseError(err);
+	}
+	return PyLong_FromLong(hz);
+}
+
+static PyObject* Handle_is_extended(HandleObject *self, PyObject *unused)
+{
+	int ret;
+	int err;
+
+	(void)unused;
+	if (handleCheck(self) < 0)
+	{
+		return NULL;
+	}
+	MOSIND_CALL(ret, err, mosind_is_extended(self->h));
+	if (ret < 0)
+	{
+		return raiseError(err);
+	}
+	return PyBool_FromLong(ret);
+}
+
+static PyObject* Handle_get_stack(HandleObject *self, void *closure)
+{
+	(void)closure;
+	return PyLong_FromLong(self->stack);
+}
+
+static PyMethodDef Handle_methods[] =
+{
+	{"close", (PyCFunction)Handle_close, METH_NOARGS,
+		"Release the handle, the board stays initialized in the process"},
+	{"set_mask", (PyCFunction)Handle_set_mask, METH_VARARGS,
+		"set_mask(value): set the eight mosfets, bit 0 = mosfet 1"},
+	{"get_mask", (PyCFunction)Handle_get_mask, METH_NOARGS,
+		"get_mask() -> state of the eight mosfets, bit 0 = mosfet 1"},
+	{"set_channel", (PyCFunction)Handle_set_channel, METH_VARARGS,
+		"set_channel(channel, on): turn one mosfet [1..8] on or off"},
+	{"get_channel", (PyCFunction)Handle_get_channel, METH_VARARGS,
+		"get_channel(channel) -> 1 if the mosfet [1..8] is on"},
+	{"pwm_write", (PyCFunction)Handle_pwm_write, METH_VARARGS,
+		"pwm_write(channel, per_mille): one fill factor [0..1000]"},
+	{"pwm_read", (PyCFunction)Handle_pwm_read, METH_VARARGS,
+		"pwm_read(channel) -> fill factor [0..1000]"},
+	{"pwm_write_all", (PyCFunction)Handle_pwm_write_all, METH_VARARGS,
+		"pwm_write_all([8 x per_mille]): the eight fill factors in one transfer"},
+	{"pwm_read_all", (PyCFunction)Handle_pwm_read_all, METH_NOARGS,
+		"pwm_read_all() -> the eight fill factors [0..1000], one transfer"},
+	{"freq_write", (PyCFunction)Handle_freq_write, METH_VARARGS,
+		"freq_write(hz): pwm frequency [16..1000]"},
+	{"freq_read", (PyCFunction)Handle_freq_read, METH_NOARGS,
+		"freq_read() -> pwm frequency in Hz"},
+	{"is_extended", (PyCFunction)Handle_is_extended, METH_NOARGS,
+		"is_extended() -> False for a plain I/O expander board (no pwm)"},
+	{NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef Handle_getset[] =
+{
+	{"stack", (getter)Handle_get_stack, NULL, "stack level of the board", NULL},
+	{NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject HandleType =
+{
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "lib8mosind._mosind.Handle",
+	.tp_doc = "Handle(stack): open board of the 8-MOSFETS stack",
+	.tp_basicsize = sizeof(HandleObject),
+	.tp_itemsize = 0,
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_new = PyType_GenericNew,
+	.tp_init = (initproc)Handle_init,
+	.tp_dealloc = (destructor)Handle_dealloc,
+	.tp_methods = Handle_methods,
+	.tp_getset = Handle_getset,
+};
+
+static PyObject* mod_release(PyObject *self, PyObject *unused)
+{
+	(void)self;
+	(void)unused;
+	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&gLock);
+	mosind_release();
+	pthread_mutex_unlock(&gLock);
+	Py_END_ALLOW_THREADS
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef module_methods[] =
+{
+	{"release", (PyCFunction)mod_release, METH_NOARGS,
+		"Close every board and bus, the next Handle() detects the boards again"},
+	{NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef module =
+{
+	PyModuleDef_HEAD_INIT,
+	"_mosind",
+	"Native binding of libmosind",
+	-1,
+	module_methods,
+	NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit__mosind(void)
+{
+	PyObject *m = NULL;
+
+	if (PyType_Ready(&HandleType) < 0)
+	{
+		return NULL;
+	}
+	m = PyModule_Create(&module);
+	if (NULL == m)
+	{
+		return NULL;
+	}
+	gError = PyErr_NewExceptionWithDoc("lib8mosind._mosind.Error",
+		"Board operation failed, args are (code, message)", PyExc_OSError, NULL);
+	Py_INCREF(&HandleType);
+	if ( (NULL == gError) || (PyModule_AddObject(m, "Handle",
+		(PyObject*)&HandleType) < 0))
+	{
+		Py_DECREF(&HandleType);
+		Py_XDECREF(gError);
+		Py_DECREF(m);
+		return NULL;
+	}
+	Py_INCREF(gError);
+	PyModule_AddObject(m, "Error", gError);
+	PyModule_AddIntConstant(m, "PWM_MAX", MOSIND_PWM_MAX);
+	PyModule_AddIntConstant(m, "ERR_ARG", MOSIND_ERR_ARG);
+	PyModule_AddIntConstant(m, "ERR_NODEV", MOSIND_ERR_NODEV);
+	PyModule_AddIntConstant(m, "ERR_NACK", MOSIND_ERR_NACK);
+	PyModule_AddIntConstant(m, "ERR_BUS", MOSIND_ERR_BUS);
+	PyModule_AddIntConstant(m, "ERR_MISMATCH", MOSIND_ERR_MISMATCH);
+	PyModule_AddIntConstant(m, "ERR_FATAL", MOSIND_ERR_FATAL);
+	return m;
+}
@@ -0,0 +1,211 @@
+"""asyncio interface of lib8mosind.
+
+The coroutines never touch the bus: every request goes to the I/O thread of
+its bus, which runs the requests in order and returns the results through
+futures. The writes found queued together for the same board are merged in
+one OUTPORT write and one PWM write, then all of them are acknowledged.
+
+    import asyncio
+    from lib8mosind import aio
+
+    async def main():
+        await asyncio.gather(*(aio.set(0, ch, 1) for ch in range(1, 9)))
+        print(await aio.get_all(0))
+
+    asyncio.run(main())
+"""
+import asyncio
+import collections
+import threading
+
+import lib8mosind
+
+_READ = 0
+_WRITE = 1
+
+
+class _Request(object):
+    __slots__ = ('kind', 'stack', 'op', 'loop', 'future')
+
+    def __init__(self, kind, stack, op, loop, future):
+        self.kind = kind
+        self.stack = stack
+        self.op = op  # op(board) -> result
+        self.loop = loop
+        self.future = future
+
+
+def _settle(future, result, exc):
+    if future.cancelled():
+        return
+    if exc is not None:
+        future.set_exception(exc)
+    else:
+        future.set_result(result)
+
+
+class _Worker(threading.Thread):
+    """The only thread doing I/O on one bus"""
+
+    def __init__(self, bus):
+        threading.Thread.__init__(self, name='lib8mosind-i2c-%d' % bus)
+        self.daemon = True
+        self.bus = bus
+        self.boards = {}
+        self.queue = collections.deque()
+        self.cv = threading.Condition()
+        self.stopped = False
+        self.writes = 0  # requests acknowledged
+        self.commits = 0  # board transactions used for them
+
+    def submit(self, req):
+        with self.cv:
+            if self.stopped:
+                raise RuntimeError('lib8mosind.aio is closed')
+            self.queue.append(req)
+            self.cv.notify()
+
+    def stop(self):
+        with self.cv:
+            self.stopped = True
+            self.cv.notify()
+
+    def _reply(self, req, result=None, exc=None):
+        req.loop.call_soon_threadsafe(_settle, req.future, result, exc)
+
+    def _board(self, stack):
+        board = self.boards.get(stack)
+        if board is None:
+            board = lib8mosind.Board(stack, self.bus)
+            self.boards[stack] = board
+        return board
+
+    def _commit(self, stack, board, waiting):
+        exc = None
+        try:
+            board.__exit__(None, None, None)
+        except Exception as e:
+            exc = e
+        self.commits += 1
+        for req in waiting:
+            self._reply(req, None, exc)
+        self.writes += len(waiting)
+
+    def _run(self, batch):
+        # stack -> write requests applied to the open transaction of the board
+        pending = collections.OrderedDict()
+        for req in batch:
+            if req.future.cancelled():
+                continue
+            try:
+                board = self._board(req.stack)
+            except Exception as e:
+                self._reply(req, None, e)
+                continue
+            if req.kind == _READ and req.stack in pending:
+                # the read must see the writes queued before it
+                self._commit(req.stack, board, pending.pop(req.stack))
+            if req.kind == _WRITE and req.stack not in pending:
+                board.__enter__()
+                pending[req.stack] = []
+            try:
+                result = req.op(board)
+            except Exception as e:
+                self._reply(req, None, e)
+                continue
+            if req.kind == _WRITE:
+                pending[req.stack].append(req)
+            else:
+                self._reply(req, result)
+        for stack, waiting in pending.items():
+            self._commit(stack, self.boards[stack], waiting)
+
+    def run(self):
+        while True:
+            with self.cv:
+                while not self.queue and not self.stopped:
+                    self.cv.wait()
+                if self.stopped and not self.queue:
+                    break
+                batch = list(self.queue)
+                self.queue.clear()
+            self._run(batch)
+        for board in self.boards.values():
+            board.close()
+
+
+_workers = {}
+_workersLock = threading.Lock()
+
+
+def _worker(bus):
+    with _workersLock:
+        worker = _workers.get(bus)
+        if worker is None:
+            worker = _Worker(bus)
+            worker.start()
+            _workers[bus] = worker
+        return worker
+
+
+def _submit(kind, stack, op, bus):
+    if stack < 0 or stack > 7:
+        raise ValueError('Invalid stack level')
+    loop = asyncio.get_running_loop()
+    future = loop.create_future()
+    _worker(bus).submit(_Request(kind, stack, op, loop, future))
+    return future
+
+
+async def set(stack, mosfet, value, bus=1):
+    await _submit(_WRITE, stack, lambda b: b.set(mosfet, value), bus)
+
+
+async def set_many(stack, changes, bus=1):
+    await _submit(_WRITE, stack, lambda b: b.set_many(changes), bus)
+
+
+async def set_all(stack, value, bus=1):
+    await _submit(_WRITE, stack, lambda b: b.set_all(value), bus)
+
+
+async def get(stack, mosfet, bus=1):
+    return await _submit(_READ, stack, lambda b: b.get(mosfet), bus)
+
+
+async def get_all(stack, bus=1):
+    return await _submit(_READ, stack, lambda b: b.get_all(), bus)
+
+
+async def set_pwm(stack, mosfet, value, bus=1):
+    await _submit(_WRITE, stack, lambda b: b.pwm(mosfet, value), bus)
+
+
+async def pwm_all(stack, values, bus=1):
+    await _submit(_WRITE, stack, lambda b: b.pwm_all(values), bus)
+
+
+async def get_pwm_all(stack, bus=1):
+    return await _submit(_READ, stack, lambda b: b.get_pwm_all(), bus)
+
+
+async def refresh(stack, bus=1):
+    """Read the mosfets state from the card again, return it"""
+    return await _submit(_READ, stack, lambda b: b.refresh(), bus)
+
+
+def stats():
+    """{bus: (write requests acknowledged, board transactions used)}"""
+    with _workersLock:
+        return dict((bus, (w.writes, w.commits)) for bus, w in _workers.items())
+
+
+def close():
+    """Stop the I/O threads after the queued requests, close the boards"""
+    with _workersLock:
+        workers = list(_workers.values())
+        _workers.clear()
+    for worker in workers:
+        worker.stop()
+    for worker in workers:
+        worker.join()
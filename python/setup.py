@@ -12,10 +12,33 @@
 with open("README.md", 'r') as f:
     long_description = f.read()
 
-from setuptools import setup, find_packages
+import subprocess
+from setuptools import setup, find_packages, Extension
+
+
+def pkgconfig(flag):
+    try:
+        out = subprocess.check_output(['pkg-config', flag, 'libmosind'])
+    except (OSError, subprocess.CalledProcessError):
+        return []
+    return [f[2:] for f in out.decode().split()]
+
+
+# binding of libmosind (make install in the repository root), skipped with a
+# warning when the library is not installed: the package then uses smbus2
+mosind = Extension(
+    'lib8mosind._mosind',
+    sources=['lib8mosind/_mosind.c'],
+    include_dirs=pkgconfig('--cflags-only-I'),
+    library_dirs=pkgconfig('--libs-only-L'),
+    libraries=['mosind'],
+    optional=True,
+    )
+
 setup(
     name='sm8mosind',
     packages=find_packages(),
+    ext_modules=[mosind],
     version='1.0.2',
     license='MIT',
     description='Library to control 8mosind Automation Card',
@@ -0,0 +1,1105 @@
+/*
+ * board.c:
+ *	Register protocol of the 8-Mosfet board: detection and init of the stack,
+ *	output port shadow, mosfets, pwm, frequency and RS485 settings, grouped
+ *	updates of several boards. Used by the CLI and by libmosind
+ *
+ *	Copyright (c) 2016-2023 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ *	Author: Alexandru Burcea
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "mosfet.h"
+#include "comm.h"
+#include "inventory.h"
+#include "retry.h"
+#include "thread.h"
+
+const u8 mosfetMaskRemap[8] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80};
+const int mosfetChRemap[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+
+// mosfetMaskRemap lookup tables, filled by remapInit()
+static u8 gMosfetToIO[256];
+static u8 gIOToMosfet[256];
+static int gRemapReady = 0;
+
+/*
+ * What we know about every initialized board, filled by doBoardInit()
+ */
+typedef struct
+{
+	int dev;
+	int hwAdd;
+	int extended; // -1 unknown, 0 plain I/O expander, 1 extended memory
+	int shadowValid;
+	u8 shadow; // last OUTPORT value read from or written to the board
+	long long shadowMs;
+} MosfetBoardType;
+
+static MosfetBoardType gBoard[STACK_LEVELS];
+
+/*
+ * Output port shadow coherence:
+ *	by default (gShadowRefreshMs < 0) there is no shadow, a channel change
+ *	re-reads OUTPORT inside the exclusive bus lock, so the changes of the
+ *	other processes are kept. A caller that is the only writer of its boards
+ *	may opt in: the shadow is then seeded when doBoardInit() initialize the
+ *	expander or by the first OUTPORT access, dropped on any communication
+ *	error and, if gShadowRefreshMs > 0, re-read when older than that
+ */
+static int gShadowRefreshMs = -1;
+
+// base addresses tried by the board detection, in this order
+static int gScanBase[2] = {MOSFET8_HW_I2C_BASE_ADD,
+	MOSFET8_HW_I2C_ALTERNATE_BASE_ADD};
+static int gScanBaseCount = 2;
+
+static MosfetBoardType* boardGet(int dev)
+{
+	int i;
+
+	for (i = 0; i < STACK_LEVELS; i++)
+	{
+		if ( (gBoard[i].dev == dev) && (dev > 0))
+		{
+			return &gBoard[i];
+		}
+	}
+	return NULL;
+}
+
+static void boardRemember(int stack, int hwAdd, int extended, int initialized)
+{
+	InventoryEntryType entry;
+
+	entry.valid = 1;
+	entry.hwAdd = hwAdd;
+	entry.extended = extended;
+	entry.initialized = initialized;
+	inventorySet(stack, &entry);
+}
+
+static long long monotonicMs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * mosfetScanConfig:
+ *	Select the base addresses probed for every stack level and their order:
+ *	"pa" primary then alternate (default), "ap", "p" or "a" only one of them
+ */
+int mosfetScanConfig(const char *order)
+{
+	int base[2];
+	int cnt = 0;
+
+	if ( (NULL == order) || (strlen(order) < 1) || (strlen(order) > 2))
+	{
+		return ERROR;
+	}
+	for (; *order != 0; order++)
+	{
+		if ( (*order == 'p') || (*order == 'P'))
+		{
+			base[cnt] = MOSFET8_HW_I2C_BASE_ADD;
+		}
+		else if ( (*order == 'a') || (*order == 'A'))
+		{
+			base[cnt] = MOSFET8_HW_I2C_ALTERNATE_BASE_ADD;
+		}
+		else
+		{
+			return ERROR;
+		}
+		if ( (cnt > 0) && (base[0] == base[cnt]))
+		{
+			return ERROR;
+		}
+		cnt++;
+	}
+	memcpy(gScanBase, base, cnt * sizeof(int));
+	gScanBaseCount = cnt;
+	return OK;
+}
+
+void mosfetShadowConfig(int refreshMs)
+{
+	int i;
+
+	gShadowRefreshMs = refreshMs;
+	for (i = 0; i < STACK_LEVELS; i++)
+	{
+		gBoard[i].shadowValid = 0;
+	}
+}
+
+static void shadowUpdate(int dev, int ok, u8 io)
+{
+	MosfetBoardType *board = boardGet(dev);
+
+	if (NULL == board)
+	{
+		return;
+	}
+	board->shadowValid = ok && (gShadowRefreshMs >= 0);
+	board->shadow = io;
+	board->shadowMs = monotonicMs();
+}
+
+/*
+ * outportRead:
+ *	Read the raw output port, from the shadow if "cached" is set and the
+ *	shadow is coherent, from the board otherwise
+ */
+int outportRead(int dev, u8 *io, int cached)
+{
+	MosfetBoardType *board = boardGet(dev);
+
+	if (cached && (NULL != board) && board->shadowValid
+		&& ( (gShadowRefreshMs == 0)
+			|| (monotonicMs() - board->shadowMs < gShadowRefreshMs)))
+	{
+		*io = board->shadow;
+		return OK;
+	}
+	if (FAIL == i2cMem8Read(dev, MOSFET8_OUTPORT_REG_ADD, io, 1))
+	{
+		shadowUpdate(dev, 0, 0);
+		return FAIL;
+	}
+	shadowUpdate(dev, 1, *io);
+	return OK;
+}
+
+int outportWrite(int dev, u8 io)
+{
+	if (FAIL == i2cMem8Write(dev, MOSFET8_OUTPORT_REG_ADD, &io, 1))
+	{
+		shadowUpdate(dev, 0, 0);
+		return FAIL;
+	}
+	shadowUpdate(dev, 1, io);
+	return OK;
+}
+
+/*
+ * remapInit:
+ *	Precompute both directions of the mosfetMaskRemap permutation, with the
+ *	active low inversion of the expander pins folded in
+ */
+static void remapInit(void)
+{
+	int v;
+	int i;
+	u8 io;
+
+	for (v = 0; v < 256; v++)
+	{
+		io = 0;
+		for (i = 0; i < 8; i++)
+		{
+			if ( (v & (1 << i)) != 0)
+			{
+				io |= mosfetMaskRemap[i];
+			}
+		}
+		gMosfetToIO[v] = 0xff ^ io;
+		gIOToMosfet[0xff ^ io] = (u8)v;
+	}
+	gRemapReady = 1;
+}
+
+u8 mosfetToIO(u8 mosfet)
+{
+	if (!gRemapReady)
+	{
+		remapInit();
+	}
+	return gMosfetToIO[mosfet];
+}
+
+u8 IOToMosfet(u8 io)
+{
+	if (!gRemapReady)
+	{
+		remapInit();
+	}
+	return gIOToMosfet[io];
+}
+
+int mosfetChSet(int dev, u8 channel, OutStateEnumType state)
+{
+	int resp;
+	u8 buff[2];
+
+	if ( (channel < CHANNEL_NR_MIN) || (channel > MOSFET_CH_NR_MAX))
+	{
+		printf("Invalid mosfet nr!\n");
+		return ERROR;
+	}
+	if ( (state != ON) && (state != OFF))
+	{
+		printf("Invalid mosfet state!\n");
+		return ERROR;
+	}
+	// nobody else may write the port between our read and write
+	if (0 != i2cLock(dev, I2C_LOCK_EXCLUSIVE))
+	{
+		return FAIL;
+	}
+	if (FAIL == outportRead(dev, buff, 1))
+	{
+		i2cUnlock(dev);
+		return FAIL;
+	}
+
+	if (state == ON)
+	{
+		buff[0] &= ~ (1 << mosfetChRemap[channel - 1]);
+	}
+	else
+	{
+		buff[0] |= 1 << mosfetChRemap[channel - 1];
+	}
+	resp = outportWrite(dev, buff[0]);
+	i2cUnlock(dev);
+	return resp;
+}
+
+int mosfetChSetPwm(int dev, u8 channel, float value)
+{
+	u8 buff[2];
+	uint16_t raw = 0;
+
+	if ( (channel < CHANNEL_NR_MIN) || (channel > MOSFET_CH_NR_MAX))
+	{
+		printf("Invalid mosfet nr!\n");
+		return ERROR;
+	}
+	if(value > 100)
+	{
+		value = 100;
+	}
+	if(value < 0)
+	{
+		value = 0;
+	}
+	raw = (uint16_t)(value * 10);
+	memcpy(buff, &raw, 2);
+	return i2cMem8Write(dev, I2C_MEM_PWM1 + PWM_SIZE_B * (channel -1), buff, 2);
+
+}
+
+int mosfetChGet(int dev, u8 channel, OutStateEnumType *state)
+{
+	u8 buff[2];
+
+	if (NULL == state)
+	{
+		return ERROR;
+	}
+
+	if ( (channel < CHANNEL_NR_MIN) || (channel > MOSFET_CH_NR_MAX))
+	{
+		printf("Invalid mosfet nr!\n");
+		return ERROR;
+	}
+
+	if (FAIL == outportRead(dev, buff, 0))
+	{
+		return ERROR;
+	}
+
+	if (buff[0] & (1 << mosfetChRemap[channel - 1]))
+	{
+		*state = OFF;
+	}
+	else
+	{
+		*state = ON;
+	}
+	return OK;
+}
+
+
+int mosfetChGetPwm(int dev, u8 channel, float *value)
+{
+	u8 buff[2];
+	uint16_t raw = 0;
+
+	if (NULL == value)
+	{
+		return ERROR;
+	}
+
+	if ( (channel < CHANNEL_NR_MIN) || (channel > MOSFET_CH_NR_MAX))
+	{
+		printf("Invalid mosfet nr!\n");
+		return ERROR;
+	}
+
+	if (FAIL == i2cMem8Read(dev, I2C_MEM_PWM1 + PWM_SIZE_B * (channel -1), buff, 2))
+	{
+		return ERROR;
+	}
+	memcpy(&raw, buff, 2);
+
+	*value = (float)raw / 10;
+
+	return OK;
+}
+
+/*
+ * mosfetPwmSetAll:
+ *	Write the eight fill factors [0..PWM_MAX_PERMILLE] in one 16 bytes transfer
+ */
+int mosfetPwmSetAll(int dev, const u16 *perMille)
+{
+	u8 buff[MOSFET_NO * PWM_SIZE_B];
+	u16 raw = 0;
+	int i;
+
+	if (NULL == perMille)
+	{
+		return ERROR;
+	}
+	for (i = 0; i < MOSFET_NO; i++)
+	{
+		raw = perMille[i] > PWM_MAX_PERMILLE ? PWM_MAX_PERMILLE : perMille[i];
+		memcpy(&buff[PWM_SIZE_B * i], &raw, 2);
+	}
+	return i2cMem8Write(dev, I2C_MEM_PWM1, buff, MOSFET_NO * PWM_SIZE_B);
+}
+
+int mosfetPwmGetAll(int dev, u16 *perMille)
+{
+	u8 buff[MOSFET_NO * PWM_SIZE_B];
+	int i;
+
+	if (NULL == perMille)
+	{
+		return ERROR;
+	}
+	if (FAIL == i2cMem8Read(dev, I2C_MEM_PWM1, buff, MOSFET_NO * PWM_SIZE_B))
+	{
+		return ERROR;
+	}
+	for (i = 0; i < MOSFET_NO; i++)
+	{
+		memcpy(&perMille[i], &buff[PWM_SIZE_B * i], 2);
+	}
+	return OK;
+}
+
+int mosfetSet(int dev, int val)
+{
+	u8 buff[2];
+
+	buff[0] = mosfetToIO(0xff & val);
+
+	return outportWrite(dev, buff[0]);
+}
+
+int mosfetGet(int dev, int *val)
+{
+	u8 buff[2];
+
+	if (NULL == val)
+	{
+		return ERROR;
+	}
+	if (FAIL == outportRead(dev, buff, 0))
+	{
+		return ERROR;
+	}
+	*val = IOToMosfet(buff[0]);
+	return OK;
+}
+
+
+int mosfetSetFrequency(int dev, int val)
+{
+	u8 buff[2];
+	uint16_t raw = 0;
+
+	if (val < MOS_MIN_FREQ || val > MOS_MAX_FREQ)
+	{
+		printf("Frequency out of range [%d..%d]\n", MOS_MIN_FREQ, MOS_MAX_FREQ);
+		return ERROR;
+	}
+	raw = (uint16_t)val;
+	memcpy(buff, &raw, 2);
+	return i2cMem8Write(dev, I2C_PWM_FREQ, buff, 2);
+}
+
+int mosfetGetFrequency(int dev, int *val)
+{
+	u8 buff[2];
+	uint16_t raw = 0;
+
+	if (NULL == val)
+	{
+		return ERROR;
+	}
+	if (FAIL == i2cMem8Read(dev, I2C_PWM_FREQ, buff, 2))
+	{
+		return ERROR;
+	}
+	memcpy(&raw, buff, 2);
+	*val = raw;
+
+	return OK;
+}
+
+int cfg485Set(int dev, u8 mode, u32 baud, u8 stopB, u8 parity, u8 add)
+{
+	ModbusSetingsType settings;
+	u8 buff[5];
+
+	if (baud > 921600 || baud < 1200)
+	{
+		printf("Invalid RS485 Baudrate [1200, 921600]!\n");
+		return ERROR;
+	}
+	if (mode > 1)
+	{
+		printf("Invalid RS485 mode : 0 = disable, 1= Modbus RTU (Slave)!\n");
+		return ERROR;
+	}
+	if (stopB < 1 || stopB > 2)
+	{
+		printf("Invalid RS485 stop bits [1, 2]!\n");
+		return ERROR;
+	}
+	if (parity > 2)
+	{
+		printf("Invalid RS485 parity 0 = none; 1 = even; 2 = odd! \n");
+		return ERROR;
+	}
+	if (add < 1)
+	{
+		printf("Invalid MODBUS device address: [1, 255]!\n");
+	}
+	settings.mbBaud = baud;
+	settings.mbType = mode;
+	settings.mbParity = parity;
+	settings.mbStopB = stopB;
+	settings.add = add;
+
+	memcpy(buff, &settings, sizeof(ModbusSetingsType));
+	if (OK != i2cMem8Write(dev, I2C_MODBUS_SETINGS_ADD, buff, 5))
+	{
+		printf("Fail to write RS485 settings!\n");
+		return ERROR;
+	}
+	return OK;
+}
+
+/*
+ * cfg485Get:
+ *	Read the RS485 / MODBUS settings
+ */
+int cfg485Get(int dev, ModbusSetingsType *settings)
+{
+	u8 buff[5];
+
+	if (NULL == settings)
+	{
+		return ERROR;
+	}
+	if (OK != i2cMem8Read(dev, I2C_MODBUS_SETINGS_ADD, buff, 5))
+	{
+		printf("Fail to read RS485 settings!\n");
+		return ERROR;
+	}
+	memcpy(settings, buff, sizeof(ModbusSetingsType));
+	return OK;
+}
+
+/*
+ * mosfetIsExtended:
+ *	Return 1 if the board has the extended memory (pwm, diagnostics, RS485),
+ *	0 for a plain I/O expander. The answer is probed once with a revision read
+ */
+int mosfetIsExtended(int dev)
+{
+	MosfetBoardType *board = boardGet(dev);
+	u8 buff[4];
+	int extended = 0;
+
+	if ( (NULL != board) && (board->extended >= 0))
+	{
+		return board->extended;
+	}
+	if (OK == i2cMem8Read(dev, I2C_MEM_REVISION_HW_MAJOR_ADD, buff, 4))
+	{
+		extended = 1;
+	}
+	if (NULL != board)
+	{
+		board->extended = extended;
+		if (extended) // a NACK may be transient, cache only the positive answer
+		{
+			boardRemember(board - gBoard, board->hwAdd, extended, 1);
+		}
+	}
+	return extended;
+}
+
+/*
+ * mosfetImageRead:
+ *	Fetch the registers from I2C_INPORT_REG_ADD up to I2C_PWM_FREQ with one
+ *	burst read and decode them. Plain I/O expanders do not auto-increment the
+ *	register pointer, for them the four expander registers are read one by one
+ */
+int mosfetImageRead(int dev, MosfetImageType *img)
+{
+	u8 buff[MOSFET8_IMAGE_SIZE];
+	int i;
+
+	if (NULL == img)
+	{
+		return ERROR;
+	}
+	memset(img, 0, sizeof(MosfetImageType));
+	if (mosfetIsExtended(dev))
+	{
+		if (OK != i2cMem8ReadBlock(dev, I2C_INPORT_REG_ADD, buff,
+		MOSFET8_IMAGE_SIZE))
+		{
+			return ERROR;
+		}
+		img->extended = 1;
+		memcpy(&img->diag3v3mV, &buff[I2C_MEM_DIAG_3V3_MV_ADD], 2);
+		img->temperature = (int8_t)buff[I2C_MEM_DIAG_TEMPERATURE_ADD];
+		for (i = 0; i < MOSFET_NO; i++)
+		{
+			memcpy(&img->pwm[i], &buff[I2C_MEM_PWM1 + PWM_SIZE_B * i], 2);
+		}
+		memcpy(&img->modbus, &buff[I2C_MODBUS_SETINGS_ADD],
+			sizeof(ModbusSetingsType));
+		memcpy(&img->pwmFreq, &buff[I2C_PWM_FREQ], 2);
+	}
+	else
+	{
+		for (i = I2C_INPORT_REG_ADD; i <= I2C_CFG_REG_ADD; i++)
+		{
+			if (OK != i2cMem8Read(dev, i, &buff[i], 1))
+			{
+				return ERROR;
+			}
+		}
+	}
+	img->inport = buff[I2C_INPORT_REG_ADD];
+	img->outport = buff[I2C_OUTPORT_REG_ADD];
+	img->polinv = buff[I2C_POLINV_REG_ADD];
+	img->cfg = buff[I2C_CFG_REG_ADD];
+	img->mosfets = IOToMosfet(img->outport);
+	return OK;
+}
+
+/*
+ * mosfetDiagRead:
+ *	Fetch the output port and the diagnostics, I2C_OUTPORT_REG_ADD up to
+ *	I2C_MEM_DIAG_TEMPERATURE_ADD, with one burst read; only the output port
+ *	for the plain I/O expanders
+ */
+int mosfetDiagRead(int dev, MosfetDiagType *diag)
+{
+	u8 buff[I2C_MEM_PWM1];
+
+	if (NULL == diag)
+	{
+		return ERROR;
+	}
+	memset(diag, 0, sizeof(MosfetDiagType));
+	if (!mosfetIsExtended(dev))
+	{
+		if (OK != outportRead(dev, buff, 0))
+		{
+			return ERROR;
+		}
+		diag->mosfets = IOToMosfet(buff[0]);
+		return OK;
+	}
+	if (OK != i2cMem8ReadBlock(dev, I2C_OUTPORT_REG_ADD, &buff[I2C_OUTPORT_REG_ADD],
+		I2C_MEM_PWM1 - I2C_OUTPORT_REG_ADD))
+	{
+		shadowUpdate(dev, 0, 0);
+		return ERROR;
+	}
+	shadowUpdate(dev, 1, buff[I2C_OUTPORT_REG_ADD]);
+	diag->extended = 1;
+	diag->mosfets = IOToMosfet(buff[I2C_OUTPORT_REG_ADD]);
+	memcpy(&diag->diag3v3mV, &buff[I2C_MEM_DIAG_3V3_MV_ADD], 2);
+	diag->temperature = (int8_t)buff[I2C_MEM_DIAG_TEMPERATURE_ADD];
+	return OK;
+}
+
+/*
+ * doBoardInit:
+ *	Open and initialize the board at "stack" level. A board found initialized
+ *	in the inventory is opened without any transaction, one with only the
+ *	address known is checked there first; the inventory entry is dropped when
+ *	the board does not answer and by doBoardRelease() after bus errors
+ */
+int doBoardInit(int stack)
+{
+	InventoryEntryType entry;
+	int dev = -1;
+	int add = 0;
+	int seeded = 0;
+	int i;
+	uint8_t buff[8];
+
+	if ( (stack < 0) || (stack > 7))
+	{
+		printf("Invalid stack level [0..7]!");
+		return ERROR;
+	}
+	if (gBoard[stack].dev > 0) // already initialized by this process
+	{
+		return gBoard[stack].dev;
+	}
+	entry.extended = -1;
+	if (OK == inventoryGet(stack, &entry))
+	{
+		add = entry.hwAdd;
+		dev = i2cSetup(add);
+		if (dev == -1)
+		{
+			return ERROR;
+		}
+		if (entry.initialized)
+		{
+			gBoard[stack].dev = dev;
+			gBoard[stack].hwAdd = add;
+			gBoard[stack].extended = entry.extended;
+			gBoard[stack].shadowValid = 0;
+			return dev;
+		}
+		if (OK != i2cMem8Read(dev, MOSFET8_CFG_REG_ADD, buff, 1))
+		{
+			i2cClose(dev);
+			dev = -1;
+			entry.extended = -1;
+			inventoryDrop(stack);
+		}
+	}
+	for (i = 0; (dev == -1) && (i < gScanBaseCount); i++)
+	{
+		add = (stack + gScanBase[i]) ^ 0x07;
+		dev = i2cSetup(add);
+		if (dev == -1)
+		{
+			return ERROR;
+		}
+		if (OK != i2cMem8Read(dev, MOSFET8_CFG_REG_ADD, buff, 1))
+		{
+			i2cClose(dev);
+			dev = -1;
+		}
+	}
+	if (dev == -1)
+	{
+		printf("8-MOSFETS card id %d not detected\n", stack);
+		return ERROR;
+	}
+	if (buff[0] != 0) //non initialized I/O Expander
+	{
+		// make all I/O pins output
+		buff[0] = 0;
+		if (0 > i2cMem8Write(dev, MOSFET8_CFG_REG_ADD, buff, 1))
+		{
+			i2cClose(dev);
+			return ERROR;
+		}
+		// put all pins in 0-logic state
+		buff[0] = 0xff;
+		if (0 > i2cMem8Write(dev, MOSFET8_OUTPORT_REG_ADD, buff, 1))
+		{
+			i2cClose(dev);
+			return ERROR;
+		}
+		seeded = 1;
+	}
+	if (gBoard[stack].dev != dev)
+	{
+		gBoard[stack].dev = dev;
+		gBoard[stack].hwAdd = add;
+		gBoard[stack].extended = entry.extended;
+		gBoard[stack].shadowValid = 0;
+	}
+	if (seeded) // just initialized above, the output port is known
+	{
+		shadowUpdate(dev, 1, 0xff);
+	}
+	boardRemember(stack, add, gBoard[stack].extended, 1);
+
+	return dev;
+}
+
+/*
+ * doBoardRelease:
+ *	Close the boards initialized by doBoardInit(), the next call will probe
+ *	again. "drop" remove them from the inventory too, after a bus error
+ */
+void doBoardRelease(int drop)
+{
+	int i;
+
+	retryFlush(); // the deferred read backs need the handles
+	for (i = 0; i < STACK_LEVELS; i++)
+	{
+		if (gBoard[i].dev > 0)
+		{
+			i2cClose(gBoard[i].dev);
+			if (drop)
+			{
+				inventoryDrop(i);
+			}
+		}
+		memset(&gBoard[i], 0, sizeof(MosfetBoardType));
+	}
+	inventoryFlush();
+}
+
+/*
+ * doBoardForget:
+ *	Close one board and drop it from the inventory, the next doBoardInit()
+ *	probes it again. Used after a communication error on that board
+ */
+void doBoardForget(int stack)
+{
+	if ( (stack < 0) || (stack >= STACK_LEVELS))
+	{
+		return;
+	}
+	retryFlush();
+	if (gBoard[stack].dev > 0)
+	{
+		i2cClose(gBoard[stack].dev);
+	}
+	memset(&gBoard[stack], 0, sizeof(MosfetBoardType));
+	inventoryDrop(stack);
+	inventoryFlush();
+}
+
+/*
+ * mosfetScan:
+ *	Detect the stack in one pass over one bus descriptor: a presence probe on
+ *	the candidate addresses of every level, then one revision read for every
+ *	board that answered. Fill "found" (STACK_LEVELS entries) and return the
+ *	number of boards, ERROR if the bus is not usable
+ */
+int mosfetScan(MosfetScanType *found)
+{
+	InventoryEntryType entry;
+	int initialized;
+	int bus = 0;
+	int dev = 0;
+	int stack;
+	int add;
+	int i;
+	int cnt = 0;
+	u8 rev[4];
+
+	// any slave will do, the handle only carries the bus
+	bus = i2cSetup(gScanBase[0] ^ 0x07);
+	if (bus == -1)
+	{
+		return ERROR;
+	}
+	for (stack = 0; stack < STACK_LEVELS; stack++)
+	{
+		for (i = 0; i < gScanBaseCount; i++)
+		{
+			add = (stack + gScanBase[i]) ^ 0x07;
+			if (OK == i2cProbe(bus, add))
+			{
+				break;
+			}
+			if (i2cLastError() == I2C_ERR_FATAL)
+			{
+				i2cClose(bus);
+				return ERROR;
+			}
+		}
+		if (i == gScanBaseCount)
+		{
+			inventoryDrop(stack);
+			continue;
+		}
+		memset(&found[cnt], 0, sizeof(MosfetScanType));
+		found[cnt].stack = stack;
+		found[cnt].hwAdd = add;
+		found[cnt].alternate = gScanBase[i] == MOSFET8_HW_I2C_ALTERNATE_BASE_ADD;
+		dev = i2cSetup(add); // same bus, no new descriptor
+		if ( (dev != -1)
+			&& (OK == i2cMem8Read(dev, I2C_MEM_REVISION_HW_MAJOR_ADD, rev, 4)))
+		{
+			found[cnt].extended = 1;
+			found[cnt].hwMajor = rev[0];
+			found[cnt].hwMinor = rev[1];
+			found[cnt].fwMajor = rev[2];
+			found[cnt].fwMinor = rev[3];
+		}
+		if (dev != -1)
+		{
+			i2cClose(dev);
+		}
+		// a full scan is authoritative for the addresses, not for the init state
+		initialized = (OK == inventoryGet(stack, &entry)) && (entry.hwAdd == add)
+			&& entry.initialized;
+		boardRemember(stack, add, found[cnt].extended ? 1 : -1, initialized);
+		cnt++;
+	}
+	i2cClose(bus);
+	return cnt;
+}
+
+/*
+ * Read backs of mosfetSync() for retryCheck()
+ */
+static int syncOutWrite(int dev, const void *arg)
+{
+	return outportWrite(dev, *(const u8 *)arg);
+}
+
+static int syncOutCheck(int dev, const void *arg)
+{
+	u8 back = 0;
+
+	if (OK != outportRead(dev, &back, 0))
+	{
+		return FAIL;
+	}
+	return back == *(const u8 *)arg ? OK : RETRY_MISMATCH;
+}
+
+static int syncPwmWrite(int dev, const void *arg)
+{
+	return mosfetPwmSetAll(dev, arg);
+}
+
+static int syncPwmCheck(int dev, const void *arg)
+{
+	u16 back[MOSFET_NO];
+
+	if (OK != mosfetPwmGetAll(dev, back))
+	{
+		return FAIL;
+	}
+	return memcmp(back, arg, sizeof(back)) == 0 ? OK : RETRY_MISMATCH;
+}
+
+static void syncOp(RetryOpType *op, int dev, int pwm, const void *arg)
+{
+	op->write = pwm ? &syncPwmWrite : &syncOutWrite;
+	op->check = pwm ? &syncPwmCheck : &syncOutCheck;
+	op->arg = arg;
+	op->size = pwm ? MOSFET_NO * sizeof(u16) : sizeof(u8);
+	op->dev = dev;
+}
+
+static long long elapsedNs(const struct timespec *t0, const struct timespec *t1)
+{
+	return (long long)(t1->tv_sec - t0->tv_sec) * 1000000000LL
+		+ (t1->tv_nsec - t0->tv_nsec);
+}
+
+/*
+ * mosfetSync:
+ *	Put a new state on up to STACK_LEVELS boards with the smallest skew: the
+ *	boards are resolved first (doBoardInit, no bus traffic once known), then
+ *	the pwm writes and the output port writes are sent as two back to back
+ *	groups, each one in a single I2C_RDWR transfer when the adapter can.
+ *	Unless the verification is off, all the writes are read back after in one
+ *	retryCheck() pass; when a group could not be sent its writes go one by one
+ *	through retryRun()
+ */
+int mosfetSync(const MosfetFrameType *frames, int count,
+	MosfetSyncStatType *stat)
+{
+	I2cWriteType out[STACK_LEVELS];
+	I2cWriteType pwm[STACK_LEVELS];
+	RetryOpType ops[2 * STACK_LEVELS];
+	u8 io[STACK_LEVELS];
+	u8 raw[STACK_LEVELS][MOSFET_NO * PWM_SIZE_B];
+	u16 pwmVal[STACK_LEVELS][MOSFET_NO];
+	int dev[STACK_LEVELS];
+	struct timespec t0;
+	struct timespec t1;
+	int pwmCount = 0;
+	int sent = 1;
+	int ret;
+	int i;
+	int j;
+
+	if ( (NULL == frames) || (count < 1) || (count > STACK_LEVELS))
+	{
+		return ERROR;
+	}
+	memset(stat, 0, sizeof(MosfetSyncStatType));
+	for (i = 0; i < count; i++)
+	{
+		for (j = 0; j < i; j++)
+		{
+			if (frames[j].stack == frames[i].stack)
+			{
+				printf("Board %d listed twice\n", frames[i].stack);
+				return ERROR;
+			}
+		}
+		dev[i] = doBoardInit(frames[i].stack);
+		if (dev[i] <= 0)
+		{
+			return ERROR;
+		}
+		io[i] = mosfetToIO(frames[i].mosfets);
+		out[i].dev = dev[i];
+		out[i].add = MOSFET8_OUTPORT_REG_ADD;
+		out[i].buff = &io[i];
+		out[i].size = 1;
+		if (!frames[i].pwmValid)
+		{
+			continue;
+		}
+		if (!mosfetIsExtended(dev[i]))
+		{
+			printf("Board %d has no pwm\n", frames[i].stack);
+			return ERROR;
+		}
+		for (j = 0; j < MOSFET_NO; j++)
+		{
+			pwmVal[i][j] = frames[i].pwm[j] > PWM_MAX_PERMILLE ?
+				PWM_MAX_PERMILLE : frames[i].pwm[j];
+			memcpy(&raw[i][PWM_SIZE_B * j], &pwmVal[i][j], 2);
+		}
+		pwm[pwmCount].dev = dev[i];
+		pwm[pwmCount].add = I2C_MEM_PWM1;
+		pwm[pwmCount].buff = raw[i];
+		pwm[pwmCount].size = MOSFET_NO * PWM_SIZE_B;
+		syncOp(&ops[pwmCount], dev[i], 1, pwmVal[i]);
+		pwmCount++;
+	}
+	for (i = 0; i < count; i++)
+	{
+		syncOp(&ops[pwmCount + i], dev[i], 0, &io[i]);
+	}
+	if (pwmCount > 0)
+	{
+		deadlineNow(&t0);
+		sent = OK == i2cMem8WriteMulti(pwm, pwmCount, NULL);
+		deadlineNow(&t1);
+		stat->pwmSpanNs = elapsedNs(&t0, &t1);
+	}
+	deadlineNow(&t0);
+	if (OK != i2cMem8WriteMulti(out, count, &stat->transfers))
+	{
+		sent = 0;
+	}
+	deadlineNow(&t1);
+	stat->spanNs = elapsedNs(&t0, &t1);
+	for (i = 0; i < count; i++)
+	{
+		shadowUpdate(dev[i], sent, io[i]);
+	}
+	ret = sent ? retryCheck(ops, pwmCount + count) :
+		retryRun(ops, pwmCount + count);
+	if (OK != ret)
+	{
+		printf("Fail to write the boards: %s\n", retryErrName(retryLastError()));
+		return ERROR;
+	}
+	return OK;
+}
+
+/*
+ * mosfetMaskApply:
+ *	Set, clear then toggle logical channels (bit n = channel n + 1, see
+ *	chmap.h). Only the boards whose state changes are written, all of them in
+ *	one mosfetSync() group; the current states come from the shadows
+ */
+int mosfetMaskApply(uint64_t set, uint64_t clr, uint64_t tog,
+	MosfetSyncStatType *stat)
+{
+	MosfetFrameType frames[STACK_LEVELS];
+	uint64_t touched = set | clr | tog;
+	int count = 0;
+	int stack;
+	int dev;
+	u8 io;
+	u8 cur;
+	u8 next;
+
+	memset(stat, 0, sizeof(MosfetSyncStatType));
+	for (stack = 0; stack < STACK_LEVELS; stack++, touched >>= 8, set >>= 8,
+		clr >>= 8, tog >>= 8)
+	{
+		if ( (touched & 0xff) == 0)
+		{
+			continue;
+		}
+		dev = doBoardInit(stack);
+		if ( (dev <= 0) || (OK != outportRead(dev, &io, 1)))
+		{
+			return ERROR;
+		}
+		cur = IOToMosfet(io);
+		next = ( (cur & ~(u8)clr) | (u8)set) ^ (u8)tog;
+		if (next == cur)
+		{
+			continue;
+		}
+		memset(&frames[count], 0, sizeof(MosfetFrameType));
+		frames[count].stack = stack;
+		frames[count].mosfets = next;
+		count++;
+	}
+	if (count == 0)
+	{
+		return OK;
+	}
+	return mosfetSync(frames, count, stat);
+}
+
+/*
+ * mosfetMaskGet:
+ *	Read the state of the logical channels, one output port read for every
+ *	board that has channels in the mask
+ */
+int mosfetMaskGet(uint64_t channels, uint64_t *state)
+{
+	int stack;
+	int dev;
+	u8 io;
+
+	*state = 0;
+	for (stack = 0; stack < STACK_LEVELS; stack++)
+	{
+		if ( ( (channels >> (8 * stack)) & 0xff) == 0)
+		{
+			continue;
+		}
+		dev = doBoardInit(stack);
+		if ( (dev <= 0) || (OK != outportRead(dev, &io, 0)))
+		{
+			return ERROR;
+		}
+		*state |= (uint64_t)IOToMosfet(io) << (8 * stack);
+	}
+	*state &= channels;
+	return OK;
+}
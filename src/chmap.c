@@ -0,0 +1,251 @@
+/*
+ * chmap.c:
+ *	Logical channel namespace across the stack: channel lists, 64 bit masks
+ *	and the named groups of the groups file
+ *
+ *	Copyright (c) 2016-2023 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ *	Author: Alexandru Burcea
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "mosfet.h"
+#include "chmap.h"
+
+#define CHMAP_GROUPS_MAX	32
+#define CHMAP_NAME_SIZE		32
+#define CHMAP_LINE_SIZE		256
+
+typedef struct
+{
+	char name[CHMAP_NAME_SIZE];
+	uint64_t mask;
+} ChmapGroupType;
+
+static char gPath[128] = CHMAP_GROUPS_FILE;
+static ChmapGroupType gGroup[CHMAP_GROUPS_MAX];
+static int gGroupCount = 0;
+static int gLoaded = 0;
+
+static void chmapLoad(void);
+
+/*
+ * chmapConfig:
+ *	Select the groups file, NULL or "" for no groups
+ */
+void chmapConfig(const char *path)
+{
+	if (NULL == path)
+	{
+		path = "";
+	}
+	strncpy(gPath, path, sizeof(gPath) - 1);
+	gPath[sizeof(gPath) - 1] = 0;
+	gGroupCount = 0;
+	gLoaded = 0;
+}
+
+static int chmapChannel(const char *arg, char **end)
+{
+	long ch = strtol(arg, end, 10);
+
+	if ( (*end == arg) || (ch < 1) || (ch > CHMAP_CHANNELS))
+	{
+		return ERROR;
+	}
+	return (int)ch;
+}
+
+/*
+ * chmapToken:
+ *	One element of a list: "<n>", "<first>-<last>", "0x<64 bit mask>" or the
+ *	name of a group
+ */
+static int chmapToken(const char *tok, uint64_t *mask)
+{
+	char *end = NULL;
+	unsigned long long val;
+	int first;
+	int last;
+	int i;
+
+	if ( (tok[0] == '0') && ( (tok[1] == 'x') || (tok[1] == 'X')))
+	{
+		errno = 0;
+		val = strtoull(tok, &end, 16);
+		if ( (errno == ERANGE) || (*end != 0))
+		{
+			return ERROR; // more than 64 channels or not a number
+		}
+		*mask |= val;
+		return OK;
+	}
+	if (isdigit((unsigned char)tok[0]))
+	{
+		first = chmapChannel(tok, &end);
+		last = first;
+		if ( (first != ERROR) && (*end == '-'))
+		{
+			last = chmapChannel(end + 1, &end);
+		}
+		if ( (first == ERROR) || (last == ERROR) || (last < first) || (*end != 0))
+		{
+			return ERROR;
+		}
+		for (i = first; i <= last; i++)
+		{
+			*mask |= 1ULL << (i - 1);
+		}
+		return OK;
+	}
+	chmapLoad();
+	for (i = 0; i < gGroupCount; i++)
+	{
+		if (strcasecmp(gGroup[i].name, tok) == 0)
+		{
+			*mask |= gGroup[i].mask;
+			return OK;
+		}
+	}
+	return ERROR;
+}
+
+/*
+ * chmapParse:
+ *	Translate a comma separated list of channels, ranges, masks and groups
+ *	to a 64 bit mask
+ */
+int chmapParse(const char *spec, uint64_t *mask)
+{
+	char buff[CHMAP_LINE_SIZE];
+	char *save = NULL;
+	char *tok = NULL;
+
+	*mask = 0;
+	if ( (NULL == spec) || (strlen(spec) >= sizeof(buff)))
+	{
+		return ERROR;
+	}
+	strcpy(buff, spec);
+	for (tok = strtok_r(buff, ",", &save); NULL != tok;
+		tok = strtok_r(NULL, ",", &save))
+	{
+		if (OK != chmapToken(tok, mask))
+		{
+			return ERROR;
+		}
+	}
+	return *mask == 0 ? ERROR : OK;
+}
+
+/*
+ * chmapLoad:
+ *	Read the "<name> <channel list>" lines of the groups file, a group can
+ *	use the groups defined above it
+ */
+static void chmapLoad(void)
+{
+	char line[CHMAP_LINE_SIZE];
+	char name[CHMAP_NAME_SIZE];
+	char spec[CHMAP_LINE_SIZE];
+	char *p = NULL;
+	FILE *f = NULL;
+	uint64_t mask;
+	int lineNr = 0;
+
+	if (gLoaded)
+	{
+		return;
+	}
+	gLoaded = 1; // also while loading, the groups resolve only the ones above
+	if ( (gPath[0] == 0) || (NULL == (f = fopen(gPath, "r"))))
+	{
+		return;
+	}
+	while ( (NULL != fgets(line, sizeof(line), f)) && (gGroupCount < CHMAP_GROUPS_MAX))
+	{
+		lineNr++;
+		p = strchr(line, '#');
+		if (NULL != p)
+		{
+			*p = 0;
+		}
+		if (sscanf(line, "%31s %255s", name, spec) != 2)
+		{
+			continue;
+		}
+		if (isdigit((unsigned char)name[0]) || (OK != chmapParse(spec, &mask)))
+		{
+			printf("%s:%d: invalid group\n", gPath, lineNr);
+			continue;
+		}
+		strcpy(gGroup[gGroupCount].name, name);
+		gGroup[gGroupCount].mask = mask;
+		gGroupCount++;
+	}
+	fclose(f);
+}
+
+int chmapGroupCount(void)
+{
+	chmapLoad();
+	return gGroupCount;
+}
+
+const char* chmapGroupName(int idx, uint64_t *mask)
+{
+	chmapLoad();
+	if ( (idx < 0) || (idx >= gGroupCount))
+	{
+		return NULL;
+	}
+	if (NULL != mask)
+	{
+		*mask = gGroup[idx].mask;
+	}
+	return gGroup[idx].name;
+}
+
+/*
+ * chmapFormat:
+ *	The shortest channel list of a mask, "1-4,17"; "-" for an empty mask
+ */
+int chmapFormat(uint64_t mask, char *buff, int size)
+{
+	int len = 0;
+	int first;
+	int i = 0;
+
+	buff[0] = 0;
+	if (mask == 0)
+	{
+		return snprintf(buff, size, "-");
+	}
+	while ( (i < CHMAP_CHANNELS) && (len < size))
+	{
+		if ( (mask & (1ULL << i)) == 0)
+		{
+			i++;
+			continue;
+		}
+		first = i;
+		while ( (i + 1 < CHMAP_CHANNELS) && (mask & (1ULL << (i + 1))))
+		{
+			i++;
+		}
+		len += snprintf(buff + len, size - len, len ? ",%d" : "%d", first + 1);
+		if ( (i > first) && (len < size))
+		{
+			len += snprintf(buff + len, size - len, "-%d", i + 1);
+		}
+		i++;
+	}
+	return len;
+}
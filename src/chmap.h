@@ -0,0 +1,20 @@
+#ifndef CHMAP_H_
+#define CHMAP_H_
+
+#include <stdint.h>
+
+/*
+ * Logical channels of the whole stack: channel 1..64 is mosfet
+ * ((n - 1) % 8) + 1 of the board at stack level (n - 1) / 8, bit n - 1 of a
+ * 64 bit mask
+ */
+#define CHMAP_CHANNELS	64
+#define CHMAP_GROUPS_FILE	"/etc/8mosind/groups"
+
+void chmapConfig(const char *path);
+int chmapParse(const char *spec, uint64_t *mask);
+int chmapFormat(uint64_t mask, char *buff, int size);
+int chmapGroupCount(void);
+const char* chmapGroupName(int idx, uint64_t *mask);
+
+#endif //CHMAP_H_
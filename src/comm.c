@@ -9,15 +9,24 @@
  ***********************************************************************
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <sys/ioctl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 #include "comm.h"
 
+#define I2C_RETRIES	0x0701	/* Number of times a device address is polled when not acknowledging */
+#define I2C_TIMEOUT	0x0702	/* Set timeout in units of 10 ms */
 #define I2C_SLAVE	0x0703
+#define I2C_FUNCS	0x0705	/* Get the adapter functionality mask */
+#define I2C_RDWR	0x0707	/* Combined R/W transfer (one STOP only) */
 #define I2C_SMBUS	0x0720	/* SMBus-level access */
 
 #define I2C_SMBUS_READ	1
@@ -40,49 +49,184 @@
 #define I2C_SMBUS_BLOCK_MAX	32	/* As specified in SMBus standard */
 #define I2C_SMBUS_I2C_BLOCK_MAX	32	/* Not specified but we use same structure */
 
+#define I2C_DEFAULT_BUS	1
+#define I2C_INPORT_PROBE_ADD	0	/* read only on every supported slave */
 
-int i2cSetup(int addr)
+// Opened buses and the per (bus, address) handles that share them
+
+#define I2C_BUS_MAX		4
+#define I2C_TIMEOUT_MAX_MS	1000	/* bounds of i2cBusConfig(), the settings */
+#define I2C_RETRIES_MAX		10	/* stay on the adapter after the exit */
+#define I2C_HANDLE_MAX	32
+
+typedef struct
 {
-	int file;
+	int nr;
+	void* ctx;
+	int refs;
+	int lockFd;
+	int lockDepth;
+	int lockMode;
+} I2cBusType;
+
+typedef struct
+{
+	int bus;
+	int addr;
+	int refs;
+} I2cHandleType;
+
+// Linux i2c-dev backend state for one opened /dev/i2c-N
+
+typedef struct
+{
+	int fd;
+	int slave;
+	int rdwr; // combined register reads
+	int multi; // several writes in one transfer, some adapters limit the messages
+	int quick;
+} LinuxBusType;
+
+static I2cBusType gBus[I2C_BUS_MAX];
+static I2cHandleType gHandle[I2C_HANDLE_MAX];
+static int gLastError = I2C_ERR_NONE;
+
+// kernel adapter timeout and retries, -1 keep the driver default
+static int gTimeoutMs = -1;
+static int gRetries = -1;
+
+// directory of the bus lock files, empty string = no locking
+static char gLockDir[128] = I2C_LOCK_DIR;
+
+static void* linuxOpen(int nr)
+{
+	LinuxBusType* lb = NULL;
+	unsigned long funcs = 0;
 	char filename[40];
-	sprintf(filename, "/dev/i2c-1");
+	int file;
+
+	sprintf(filename, "/dev/i2c-%d", nr);
 
 	if ( (file = open(filename, O_RDWR)) < 0)
 	{
 		printf("Failed to open the bus.");
-		return -1;
+		return NULL;
 	}
-	if (ioctl(file, I2C_SLAVE, addr) < 0)
+	lb = malloc(sizeof(LinuxBusType));
+	if (NULL == lb)
 	{
-		printf("Failed to acquire bus access and/or talk to slave.\n");
-		return -1;
+		close(file);
+		return NULL;
 	}
+	lb->fd = file;
+	lb->slave = -1;
+	lb->rdwr = 0;
+	lb->multi = 0;
+	lb->quick = 0;
+	if (ioctl(file, I2C_FUNCS, &funcs) == 0)
+	{
+		lb->rdwr = (funcs & I2C_FUNC_I2C) ? 1 : 0;
+		lb->multi = lb->rdwr;
+		lb->quick = (funcs & I2C_FUNC_SMBUS_QUICK) ? 1 : 0;
+	}
+	return lb;
+}
 
-	return file;
+static void linuxClose(void* ctx)
+{
+	LinuxBusType* lb = ctx;
+
+	close(lb->fd);
+	free(lb);
 }
 
-int i2cMem8Read(int dev, int add, uint8_t* buff, int size)
+/*
+ * linuxSelect:
+ *	Point the bus descriptor to the slave, only if it is not already there
+ */
+static int linuxSelect(LinuxBusType* lb, int addr)
 {
-	uint8_t intBuff[I2C_SMBUS_BLOCK_MAX];
+	if (lb->slave != addr)
+	{
+		if (ioctl(lb->fd, I2C_SLAVE, addr) < 0)
+		{
+			lb->slave = -1;
+			return -1;
+		}
+		lb->slave = addr;
+	}
+	return 0;
+}
 
-	if (NULL == buff)
+/*
+ * linuxReadRdwr:
+ *	Register select and read in one I2C_RDWR transfer (repeated start, no STOP
+ *	between the two messages).
+ *	Return 0 on success, -1 on bus error, -2 if the adapter rejected the request
+ */
+static int linuxReadRdwr(LinuxBusType* lb, int addr, int add, uint8_t* buff,
+	int size)
+{
+	uint8_t reg = 0xff & add;
+	struct i2c_msg msgs[2];
+	struct i2c_rdwr_ioctl_data xfer;
+
+	msgs[0].addr = addr;
+	msgs[0].flags = 0;
+	msgs[0].len = 1;
+	msgs[0].buf = &reg;
+	msgs[1].addr = addr;
+	msgs[1].flags = I2C_M_RD;
+	msgs[1].len = size;
+	msgs[1].buf = buff;
+	xfer.msgs = msgs;
+	xfer.nmsgs = 2;
+
+	if (ioctl(lb->fd, I2C_RDWR, &xfer) == 2)
 	{
-		return -1;
+		return 0;
+	}
+	if ( (errno == EOPNOTSUPP) || (errno == ENOTTY) || (errno == EINVAL))
+	{
+		return -2;
 	}
+	return -1;
+}
 
-	if (size > I2C_SMBUS_BLOCK_MAX)
+static int linuxRead(void* ctx, int addr, int add, uint8_t* buff, int size)
+{
+	LinuxBusType* lb = ctx;
+	uint8_t intBuff[I2C_SMBUS_BLOCK_MAX];
+
+	if (lb->rdwr)
+	{
+		switch (linuxReadRdwr(lb, addr, add, buff, size))
+		{
+		case 0:
+			return 0; //OK
+		case -2:
+			// adapter refused, use write() + read() from now on; the caller
+			// holds a shared lock only, it must retry under the exclusive one
+			lb->rdwr = 0;
+			errno = EAGAIN;
+			return -1;
+		default:
+			return -1;
+		}
+	}
+	if (linuxSelect(lb, addr) < 0)
 	{
 		return -1;
 	}
 
 	intBuff[0] = 0xff & add;
 
-	if (write(dev, intBuff, 1) != 1)
+	if (write(lb->fd, intBuff, 1) != 1)
 	{
 		//printf("Fail to select mem add!\n");
 		return -1;
 	}
-	if (read(dev, buff, size) != size)
+	if (read(lb->fd, buff, size) != size)
 	{
 		//printf("Fail to read memory!\n");
 		return -1;
@@ -90,28 +234,701 @@ int i2cMem8Read(int dev, int add, uint8_t* buff, int size)
 	return 0; //OK
 }
 
-int i2cMem8Write(int dev, int add, uint8_t* buff, int size)
+static int linuxWrite(void* ctx, int addr, int add, const uint8_t* buff,
+	int size)
 {
+	LinuxBusType* lb = ctx;
 	uint8_t intBuff[I2C_SMBUS_BLOCK_MAX];
 
-	if (NULL == buff)
+	if (linuxSelect(lb, addr) < 0)
+	{
+		return -1;
+	}
+
+	intBuff[0] = 0xff & add;
+	memcpy(&intBuff[1], buff, size);
+
+	if (write(lb->fd, intBuff, size + 1) != size + 1)
+	{
+		//printf("Fail to write memory!\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * linuxProbe:
+ *	Presence check like i2cdetect: SMBus quick write (address + R/W bit only)
+ *	if the adapter can do it, otherwise a one byte read without register
+ *	select, that leave the register pointer where it was
+ */
+static int linuxProbe(void* ctx, int addr)
+{
+	LinuxBusType* lb = ctx;
+	struct i2c_smbus_ioctl_data args;
+	uint8_t val;
+
+	if (linuxSelect(lb, addr) < 0)
+	{
+		return -1;
+	}
+	if (lb->quick)
+	{
+		args.read_write = I2C_SMBUS_WRITE;
+		args.command = 0;
+		args.size = I2C_SMBUS_QUICK;
+		args.data = NULL;
+		return ioctl(lb->fd, I2C_SMBUS, &args) < 0 ? -1 : 0;
+	}
+	return read(lb->fd, &val, 1) != 1 ? -1 : 0;
+}
+
+/*
+ * linuxWriteMulti:
+ *	All the register writes in one I2C_RDWR transfer: the messages are
+ *	separated by repeated starts, with only one STOP at the end.
+ *	Return 0 on success, -1 on bus error, -2 if the adapter cannot do it
+ */
+static int linuxWriteMulti(void* ctx, const int* addr, const int* add,
+	const uint8_t* const* buff, const int* size, int count)
+{
+	LinuxBusType* lb = ctx;
+	uint8_t data[I2C_MULTI_MAX][I2C_SMBUS_BLOCK_MAX];
+	struct i2c_msg msgs[I2C_MULTI_MAX];
+	struct i2c_rdwr_ioctl_data xfer;
+	int i;
+
+	if (!lb->multi || (count > I2C_MULTI_MAX))
+	{
+		return -2;
+	}
+	for (i = 0; i < count; i++)
+	{
+		data[i][0] = 0xff & add[i];
+		memcpy(&data[i][1], buff[i], size[i]);
+		msgs[i].addr = addr[i];
+		msgs[i].flags = 0;
+		msgs[i].len = size[i] + 1;
+		msgs[i].buf = data[i];
+	}
+	xfer.msgs = msgs;
+	xfer.nmsgs = count;
+	if (ioctl(lb->fd, I2C_RDWR, &xfer) == count)
+	{
+		return 0;
+	}
+	if ( (errno == EOPNOTSUPP) || (errno == ENOTTY) || (errno == EINVAL))
+	{
+		lb->multi = 0; // the combined reads keep their own flag
+		return -2;
+	}
+	return -1;
+}
+
+static int linuxAtomicRead(void* ctx)
+{
+	LinuxBusType* lb = ctx;
+
+	return lb->rdwr;
+}
+
+static int linuxConfig(void* ctx, int timeoutMs, int retries)
+{
+	LinuxBusType* lb = ctx;
+	int ret = 0;
+
+	if ( (timeoutMs >= 0)
+		&& (ioctl(lb->fd, I2C_TIMEOUT, (unsigned long)(timeoutMs + 9) / 10) < 0))
+	{
+		ret = -1;
+	}
+	if ( (retries >= 0) && (ioctl(lb->fd, I2C_RETRIES, (unsigned long)retries) < 0))
+	{
+		ret = -1;
+	}
+	return ret;
+}
+
+const I2cBackendType gI2cLinuxBackend =
+{
+	"i2c-dev",
+	&linuxOpen,
+	&linuxClose,
+	&linuxRead,
+	&linuxWrite,
+	&linuxConfig,
+	&linuxAtomicRead,
+	&linuxProbe,
+	&linuxWriteMulti
+};
+
+static const I2cBackendType* gBackend = &gI2cLinuxBackend;
+
+/*
+ * i2cSetBackend:
+ *	Select the transport used by all the buses opened after this call
+ */
+int i2cSetBackend(const I2cBackendType* backend)
+{
+	int i;
+
+	if (NULL == backend)
+	{
+		return -1;
+	}
+	for (i = 0; i < I2C_BUS_MAX; i++)
+	{
+		if (gBus[i].refs > 0)
+		{
+			return -1; // do not switch under open handles
+		}
+	}
+	gBackend = backend;
+	return 0;
+}
+
+const I2cBackendType* i2cGetBackend(void)
+{
+	return gBackend;
+}
+
+/*
+ * i2cLockConfig:
+ *	Select the directory of the lock files, NULL or "" disable the locking.
+ *	Apply to the buses opened after the call
+ */
+void i2cLockConfig(const char* dir)
+{
+	if (NULL == dir)
+	{
+		dir = "";
+	}
+	strncpy(gLockDir, dir, sizeof(gLockDir) - 1);
+	gLockDir[sizeof(gLockDir) - 1] = 0;
+}
+
+/*
+ * i2cLockFile:
+ *	Open a lock file, never through a link; only a file created by this call
+ *	is opened to the other users, an existing one is used as it is
+ */
+static int i2cLockFile(const char* filename)
+{
+	struct stat st;
+	int fd = open(filename, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0666);
+
+	if (fd >= 0)
+	{
+		fchmod(fd, 0666); // shared with the other users, whatever the umask
+		return fd;
+	}
+	if (errno != EEXIST)
+	{
+		return -1;
+	}
+	fd = open(filename, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if ( (fd >= 0) && ( (fstat(fd, &st) < 0) || !S_ISREG(st.st_mode)
+		|| (st.st_nlink != 1)))
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int i2cLockOpen(int nr)
+{
+	char filename[sizeof(gLockDir) + 32];
+	int fd;
+
+	if (gLockDir[0] == 0)
+	{
+		return -1;
+	}
+	snprintf(filename, sizeof(filename), "%s/8mosind-i2c-%d.lock", gLockDir, nr);
+	fd = i2cLockFile(filename);
+	if ( (fd < 0) && (strcmp(gLockDir, I2C_LOCK_DIR) == 0))
+	{
+		snprintf(filename, sizeof(filename), "/tmp/8mosind-i2c-%d.lock", nr);
+		fd = i2cLockFile(filename);
+	}
+	return fd;
+}
+
+static int i2cBusLock(I2cBusType* b, int mode)
+{
+	int ret;
+
+	if (b->lockFd < 0)
+	{
+		return 0;
+	}
+	if ( (b->lockDepth > 0) && (b->lockMode >= mode))
+	{
+		b->lockDepth++;
+		return 0;
+	}
+	while ( (ret = flock(b->lockFd, mode == I2C_LOCK_SHARED ? LOCK_SH : LOCK_EX))
+		< 0 && errno == EINTR)
+		continue;
+	if (ret < 0)
+	{
+		return -1;
+	}
+	b->lockMode = mode;
+	b->lockDepth++;
+	return 0;
+}
+
+static void i2cBusUnlock(I2cBusType* b)
+{
+	if ( (b->lockFd < 0) || (b->lockDepth == 0))
+	{
+		return;
+	}
+	b->lockDepth--;
+	if (b->lockDepth == 0)
+	{
+		flock(b->lockFd, LOCK_UN);
+		b->lockMode = 0;
+	}
+}
+
+static int i2cBusOpen(int nr)
+{
+	int i;
+	int slot = -1;
+
+	for (i = 0; i < I2C_BUS_MAX; i++)
+	{
+		if (gBus[i].refs > 0)
+		{
+			if (gBus[i].nr == nr)
+			{
+				return i;
+			}
+		}
+		else if (slot < 0)
+		{
+			slot = i;
+		}
+	}
+	if (slot < 0)
+	{
+		printf("Too many open buses.\n");
+		return -1;
+	}
+	gBus[slot].ctx = gBackend->open(nr);
+	if (NULL == gBus[slot].ctx)
+	{
+		return -1;
+	}
+	gBus[slot].nr = nr;
+	gBus[slot].lockFd = i2cLockOpen(nr);
+	gBus[slot].lockDepth = 0;
+	gBus[slot].lockMode = 0;
+	if ( (NULL != gBackend->config) && ( (gTimeoutMs >= 0) || (gRetries >= 0)))
+	{
+		gBackend->config(gBus[slot].ctx, gTimeoutMs, gRetries);
+	}
+	return slot;
+}
+
+/*
+ * i2cBusConfig:
+ *	Set the adapter timeout and the number of address retries done by the
+ *	kernel, on the opened buses and on the ones opened later. -1 = no change
+ */
+void i2cBusConfig(int timeoutMs, int retries)
+{
+	int i;
+
+	if (timeoutMs > I2C_TIMEOUT_MAX_MS)
+	{
+		timeoutMs = I2C_TIMEOUT_MAX_MS;
+	}
+	if (retries > I2C_RETRIES_MAX)
+	{
+		retries = I2C_RETRIES_MAX;
+	}
+	gTimeoutMs = timeoutMs;
+	gRetries = retries;
+	if (NULL == gBackend->config)
+	{
+		return;
+	}
+	for (i = 0; i < I2C_BUS_MAX; i++)
+	{
+		if (gBus[i].refs > 0)
+		{
+			gBackend->config(gBus[i].ctx, timeoutMs, retries);
+		}
+	}
+}
+
+/*
+ * i2cResult:
+ *	Record the class of a failed transaction for i2cLastError()
+ */
+static int i2cResult(int ret)
+{
+	if (ret == 0)
+	{
+		gLastError = I2C_ERR_NONE;
+		return 0;
+	}
+	switch (errno)
+	{
+	case ENXIO:
+	case EREMOTEIO:
+		gLastError = I2C_ERR_NACK;
+		break;
+	case EBADF:
+	case ENODEV:
+	case EINVAL:
+	case EOPNOTSUPP:
+		gLastError = I2C_ERR_FATAL;
+		break;
+	default:
+		gLastError = I2C_ERR_BUS;
+		break;
+	}
+	return -1;
+}
+
+int i2cLastError(void)
+{
+	return gLastError;
+}
+
+static void i2cBusRelease(int bus)
+{
+	if (gBus[bus].refs > 0)
+	{
+		gBus[bus].refs--;
+		if (gBus[bus].refs == 0)
+		{
+			gBackend->close(gBus[bus].ctx);
+			gBus[bus].ctx = NULL;
+			if (gBus[bus].lockFd >= 0)
+			{
+				close(gBus[bus].lockFd); // release any lock still held
+				gBus[bus].lockFd = -1;
+			}
+		}
+	}
+}
+
+static I2cHandleType* i2cHandleGet(int dev)
+{
+	if ( (dev < 1) || (dev > I2C_HANDLE_MAX) || (gHandle[dev - 1].refs == 0))
+	{
+		return NULL;
+	}
+	return &gHandle[dev - 1];
+}
+
+/*
+ * i2cOpen:
+ *	Return a handle (> 0) for the slave "addr" on /dev/i2c-"bus".
+ *	The bus is opened once and shared by all handles, opening the same slave
+ *	twice return the same handle. Every i2cOpen() must be paired with i2cClose()
+ */
+int i2cOpen(int bus, int addr)
+{
+	int i;
+	int b;
+	int slot = -1;
+
+	for (i = 0; i < I2C_HANDLE_MAX; i++)
+	{
+		if (gHandle[i].refs > 0)
+		{
+			if ( (gBus[gHandle[i].bus].nr == bus) && (gHandle[i].addr == addr))
+			{
+				gHandle[i].refs++;
+				return i + 1;
+			}
+		}
+		else if (slot < 0)
+		{
+			slot = i;
+		}
+	}
+	if (slot < 0)
+	{
+		printf("Too many open devices.\n");
+		return -1;
+	}
+	b = i2cBusOpen(bus);
+	if (b < 0)
+	{
+		return -1;
+	}
+	gBus[b].refs++;
+	gHandle[slot].bus = b;
+	gHandle[slot].addr = addr;
+	gHandle[slot].refs = 1;
+	return slot + 1;
+}
+
+void i2cClose(int dev)
+{
+	I2cHandleType* h = i2cHandleGet(dev);
+
+	if (NULL == h)
+	{
+		return;
+	}
+	h->refs--;
+	if (h->refs == 0)
+	{
+		i2cBusRelease(h->bus);
+	}
+}
+
+void i2cCloseAll(void)
+{
+	int i;
+
+	for (i = 0; i < I2C_HANDLE_MAX; i++)
+	{
+		if (gHandle[i].refs > 0)
+		{
+			gHandle[i].refs = 1;
+			i2cClose(i + 1);
+		}
+	}
+}
+
+int i2cLock(int dev, int mode)
+{
+	I2cHandleType* h = i2cHandleGet(dev);
+
+	if (NULL == h)
+	{
+		return -1;
+	}
+	return i2cBusLock(&gBus[h->bus], mode);
+}
+
+void i2cUnlock(int dev)
+{
+	I2cHandleType* h = i2cHandleGet(dev);
+
+	if (NULL != h)
+	{
+		i2cBusUnlock(&gBus[h->bus]);
+	}
+}
+
+int i2cSetup(int addr)
+{
+	return i2cOpen(I2C_DEFAULT_BUS, addr);
+}
+
+int i2cMem8Read(int dev, int add, uint8_t* buff, int size)
+{
+	I2cHandleType* h = i2cHandleGet(dev);
+	I2cBusType* b = NULL;
+	int mode = I2C_LOCK_SHARED;
+	int ret;
+
+	if ( (NULL == buff) || (NULL == h))
+	{
+		gLastError = I2C_ERR_FATAL;
+		return -1;
+	}
+
+	if (size > I2C_SMBUS_BLOCK_MAX)
 	{
+		gLastError = I2C_ERR_FATAL;
+		return -1;
+	}
+	b = &gBus[h->bus];
+	if ( (NULL != gBackend->atomicRead) && !gBackend->atomicRead(b->ctx))
+	{
+		mode = I2C_LOCK_EXCLUSIVE; // select + read, nobody may move the pointer between
+	}
+	if (i2cBusLock(b, mode) < 0)
+	{
+		gLastError = I2C_ERR_BUS;
+		return -1;
+	}
+	ret = gBackend->read(b->ctx, h->addr, add, buff, size);
+	if ( (ret < 0) && (errno == EAGAIN))
+	{
+		// the combined read was just found unsupported, the select + read
+		// fallback runs with the bus held alone
+		i2cBusUnlock(b);
+		if (i2cBusLock(b, I2C_LOCK_EXCLUSIVE) < 0)
+		{
+			gLastError = I2C_ERR_BUS;
+			return -1;
+		}
+		ret = gBackend->read(b->ctx, h->addr, add, buff, size);
+	}
+	ret = i2cResult(ret);
+	i2cBusUnlock(b);
+	return ret;
+}
+
+int i2cMem8Write(int dev, int add, uint8_t* buff, int size)
+{
+	I2cHandleType* h = i2cHandleGet(dev);
+	I2cBusType* b = NULL;
+	int ret;
+
+	if ( (NULL == buff) || (NULL == h))
+	{
+		gLastError = I2C_ERR_FATAL;
 		return -1;
 	}
 
 	if (size > I2C_SMBUS_BLOCK_MAX - 1)
 	{
+		gLastError = I2C_ERR_FATAL;
+		return -1;
+	}
+	b = &gBus[h->bus];
+	if (i2cBusLock(b, I2C_LOCK_EXCLUSIVE) < 0)
+	{
+		gLastError = I2C_ERR_BUS;
 		return -1;
 	}
+	ret = i2cResult(gBackend->write(b->ctx, h->addr, add, buff, size));
+	i2cBusUnlock(b);
+	return ret;
+}
 
-	intBuff[0] = 0xff & add;
-	memcpy(&intBuff[1], buff, size);
+/*
+ * i2cProbe:
+ *	Check if the slave "addr" answers on the bus of the handle "dev", without
+ *	opening a handle for it, so a whole bus can be scanned on one descriptor.
+ *	Return 0 if the slave acknowledged
+ */
+int i2cProbe(int dev, int addr)
+{
+	I2cHandleType* h = i2cHandleGet(dev);
+	I2cBusType* b = NULL;
+	uint8_t val;
+	int ret;
 
-	if (write(dev, intBuff, size + 1) != size + 1)
+	if (NULL == h)
 	{
-		//printf("Fail to write memory!\n");
+		gLastError = I2C_ERR_FATAL;
 		return -1;
 	}
+	b = &gBus[h->bus];
+	if (i2cBusLock(b, I2C_LOCK_SHARED) < 0)
+	{
+		gLastError = I2C_ERR_BUS;
+		return -1;
+	}
+	if (NULL != gBackend->probe)
+	{
+		ret = gBackend->probe(b->ctx, addr);
+	}
+	else
+	{
+		ret = gBackend->read(b->ctx, addr, I2C_INPORT_PROBE_ADD, &val, 1);
+	}
+	ret = i2cResult(ret);
+	i2cBusUnlock(b);
+	return ret;
+}
+
+/*
+ * i2cMem8WriteMulti:
+ *	Send a group of register writes, to one or several slaves, back to back
+ *	under one bus lock: in a single transfer if the backend can do it,
+ *	otherwise one after the other. "transfers" receive the number of bus
+ *	transfers used
+ */
+int i2cMem8WriteMulti(const I2cWriteType* w, int count, int* transfers)
+{
+	int addr[I2C_MULTI_MAX];
+	int add[I2C_MULTI_MAX];
+	const uint8_t* buff[I2C_MULTI_MAX];
+	int size[I2C_MULTI_MAX];
+	I2cHandleType* h = NULL;
+	I2cBusType* b = NULL;
+	int ret = -2;
+	int i;
+
+	if ( (NULL == w) || (count < 1) || (count > I2C_MULTI_MAX))
+	{
+		gLastError = I2C_ERR_FATAL;
+		return -1;
+	}
+	for (i = 0; i < count; i++)
+	{
+		h = i2cHandleGet(w[i].dev);
+		if ( (NULL == h) || (NULL == w[i].buff) || (w[i].size < 1)
+			|| (w[i].size > I2C_SMBUS_BLOCK_MAX - 1) || ( (NULL != b) && (b != &gBus[h->bus])))
+		{
+			gLastError = I2C_ERR_FATAL;
+			return -1;
+		}
+		b = &gBus[h->bus];
+		addr[i] = h->addr;
+		add[i] = w[i].add;
+		buff[i] = w[i].buff;
+		size[i] = w[i].size;
+	}
+	if (i2cBusLock(b, I2C_LOCK_EXCLUSIVE) < 0)
+	{
+		gLastError = I2C_ERR_BUS;
+		return -1;
+	}
+	if (NULL != gBackend->writeMulti)
+	{
+		ret = gBackend->writeMulti(b->ctx, addr, add, buff, size, count);
+		if (NULL != transfers)
+		{
+			*transfers = 1;
+		}
+	}
+	if (ret == -2)
+	{
+		for (i = 0, ret = 0; (i < count) && (ret == 0); i++)
+		{
+			ret = gBackend->write(b->ctx, addr[i], add[i], buff[i], size[i]);
+		}
+		if (NULL != transfers)
+		{
+			*transfers = count;
+		}
+	}
+	ret = i2cResult(ret);
+	i2cBusUnlock(b);
+	return ret;
+}
+
+/*
+ * i2cMem8ReadBlock:
+ *	Read "size" consecutive registers, in as few transactions as the
+ *	I2C_SMBUS_BLOCK_MAX limit allows
+ */
+int i2cMem8ReadBlock(int dev, int add, uint8_t* buff, int size)
+{
+	int chunk;
+
+	if (NULL == buff)
+	{
+		return -1;
+	}
+	while (size > 0)
+	{
+		chunk = size > I2C_SMBUS_BLOCK_MAX ? I2C_SMBUS_BLOCK_MAX : size;
+		if (0 != i2cMem8Read(dev, add, buff, chunk))
+		{
+			return -1;
+		}
+		add += chunk;
+		buff += chunk;
+		size -= chunk;
+	}
 	return 0;
 }
 
@@ -3,9 +3,81 @@
 
 #include <stdint.h>
 
+/*
+ * Transport backend: every bus is opened through "open" and every register
+ * access is one transaction addressed to the 7 bit slave "addr".
+ * read/write return 0 on success and -1 on error (errno set), writeMulti
+ * return -2 if the adapter cannot combine the messages in one transfer.
+ * read fails with EAGAIN when atomicRead just turned 0, the caller retries
+ * it under the exclusive lock
+ */
+typedef struct
+{
+	const char* name;
+	void* (*open)(int bus);
+	void (*close)(void* ctx);
+	int (*read)(void* ctx, int addr, int add, uint8_t* buff, int size);
+	int (*write)(void* ctx, int addr, int add, const uint8_t* buff, int size);
+	int (*config)(void* ctx, int timeoutMs, int retries); // optional
+	int (*atomicRead)(void* ctx); // optional, 0 if a read takes two transactions
+	int (*probe)(void* ctx, int addr); // optional, cheapest ACK check
+	int (*writeMulti)(void* ctx, const int* addr, const int* add,
+		const uint8_t* const* buff, const int* size, int count); // optional, one transfer
+} I2cBackendType;
+
+// Class of the last failed transaction
+
+#define I2C_ERR_NONE	0
+#define I2C_ERR_NACK	1	/* slave did not answer, usually transient */
+#define I2C_ERR_BUS		2	/* timeout, arbitration lost, I/O error */
+#define I2C_ERR_FATAL	3	/* invalid handle or request, retry is useless */
+
+extern const I2cBackendType gI2cLinuxBackend;
+
+int i2cSetBackend(const I2cBackendType* backend);
+const I2cBackendType* i2cGetBackend(void);
+
+int i2cOpen(int bus, int addr);
+void i2cClose(int dev);
+void i2cCloseAll(void);
 int i2cSetup(int addr);
 int i2cMem8Read(int dev, int add, uint8_t* buff, int size);
 int i2cMem8Write(int dev, int add, uint8_t* buff, int size);
+int i2cMem8ReadBlock(int dev, int add, uint8_t* buff, int size);
+int i2cProbe(int dev, int addr);
+
+/*
+ * One register write of a group sent back to back by i2cMem8WriteMulti(),
+ * all the handles must be on the same bus
+ */
+#define I2C_MULTI_MAX	16
+
+typedef struct
+{
+	int dev;
+	int add;
+	const uint8_t* buff;
+	int size;
+} I2cWriteType;
+
+int i2cMem8WriteMulti(const I2cWriteType* w, int count, int* transfers);
+int i2cLastError(void);
+void i2cBusConfig(int timeoutMs, int retries);
+
+/*
+ * Cross-process bus lock (flock on a per bus file, released by the kernel if
+ * the owner dies). Every transaction locks the bus by itself, shared for
+ * single transaction reads and exclusive for the rest; i2cLock()/i2cUnlock()
+ * extend the lock over a sequence of transactions and can be nested
+ */
+#define I2C_LOCK_SHARED		1
+#define I2C_LOCK_EXCLUSIVE	2
+
+#define I2C_LOCK_DIR	"/run/lock"
+
+int i2cLock(int dev, int mode);
+void i2cUnlock(int dev);
+void i2cLockConfig(const char* dir);
 
 
 #endif //COMM_H_
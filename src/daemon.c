@@ -0,0 +1,393 @@
+/*
+ * daemon.c:
+ *	Resident server: keep the boards initialized and execute the command
+ *	lines received on a Unix domain socket
+ *
+ *	Copyright (c) 2016-2023 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ *	Author: Alexandru Burcea
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <grp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "mosfet.h"
+#include "daemon.h"
+
+#define DAEMON_CLIENTS_MAX	256
+#define DAEMON_LINE_SIZE	1024
+#define DAEMON_EVENTS		32
+#define DAEMON_BACKLOG		16
+#define DAEMON_LINES_MAX	16	/* requests run per client and wakeup */
+#define DAEMON_OUT_MAX		65536	/* answers queued for a client */
+
+typedef struct
+{
+	int fd;
+	unsigned long seq;
+	char in[DAEMON_LINE_SIZE];
+	size_t inLen;
+	char *out;
+	size_t outLen;
+	size_t outSize;
+	int closing;
+} DaemonClientType;
+
+static volatile sig_atomic_t gStop = 0;
+
+static void daemonSignal(int sig)
+{
+	(void)sig;
+	gStop = 1;
+}
+
+static int daemonNonBlock(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+
+	if (flags < 0)
+	{
+		return -1;
+	}
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static int daemonAppend(DaemonClientType *c, const char *data, size_t len)
+{
+	char *p = NULL;
+	size_t size = c->outSize;
+
+	if (c->outLen + len > DAEMON_OUT_MAX)
+	{
+		return -1;
+	}
+	if (c->outLen + len > size)
+	{
+		while (c->outLen + len > size)
+		{
+			size = size ? size * 2 : DAEMON_LINE_SIZE;
+		}
+		p = realloc(c->out, size);
+		if (NULL == p)
+		{
+			return -1;
+		}
+		c->out = p;
+		c->outSize = size;
+	}
+	memcpy(c->out + c->outLen, data, len);
+	c->outLen += len;
+	return 0;
+}
+
+/*
+ * daemonExecute:
+ *	Run one request with stdout captured, queue the output followed by
+ *	"<request nr>: ok|fail"
+ */
+static void daemonExecute(DaemonClientType *c, char *line,
+	DaemonHandlerType handler)
+{
+	FILE *saved = stdout;
+	FILE *mem = NULL;
+	char *buff = NULL;
+	size_t len = 0;
+	char status[64];
+	int ret;
+
+	mem = open_memstream(&buff, &len);
+	if (NULL == mem)
+	{
+		c->closing = 1;
+		return;
+	}
+	fflush(stdout);
+	stdout = mem;
+	ret = handler(line);
+	fflush(stdout);
+	stdout = saved;
+	fclose(mem);
+	if (ret == DAEMON_EMPTY)
+	{
+		free(buff);
+		return;
+	}
+	c->seq++;
+	len = snprintf(status, sizeof(status), "%lu: %s\n", c->seq,
+		ret == OK ? "ok" : "fail");
+	if ( (daemonAppend(c, buff, strlen(buff)) < 0)
+		|| (daemonAppend(c, status, len) < 0))
+	{
+		c->outLen = 0; // the client does not read its answers, drop it
+		c->closing = 1;
+	}
+	free(buff);
+}
+
+static void daemonFlush(DaemonClientType *c)
+{
+	ssize_t n;
+
+	while (c->outLen > 0)
+	{
+		n = send(c->fd, c->out, c->outLen, MSG_NOSIGNAL);
+		if (n < 0)
+		{
+			if ( (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+			{
+				c->outLen = 0;
+				c->closing = 1;
+			}
+			return;
+		}
+		memmove(c->out, c->out + n, c->outLen - n);
+		c->outLen -= n;
+	}
+}
+
+/*
+ * daemonRead:
+ *	Append one read of the available data to the input buffer, the lines are
+ *	executed by daemonLines()
+ */
+static void daemonRead(DaemonClientType *c)
+{
+	ssize_t n;
+
+	n = recv(c->fd, c->in + c->inLen, DAEMON_LINE_SIZE - 1 - c->inLen, 0);
+	if (n == 0)
+	{
+		c->closing = 1;
+		return;
+	}
+	if (n < 0)
+	{
+		if ( (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+		{
+			c->closing = 1;
+		}
+		return;
+	}
+	c->inLen += n;
+	c->in[c->inLen] = 0;
+	if ( (c->inLen >= DAEMON_LINE_SIZE - 1) && (NULL == strchr(c->in, '\n')))
+	{
+		c->closing = 1; // line too long
+	}
+}
+
+/*
+ * daemonLines:
+ *	Execute the complete lines of the input buffer in order, so a client can
+ *	pipeline requests, but at most DAEMON_LINES_MAX per wakeup: the others
+ *	wait until the answers are sent, a client that does not read them can
+ *	not hold the loop or the memory
+ */
+static void daemonLines(DaemonClientType *c, DaemonHandlerType handler)
+{
+	char *eol = NULL;
+	size_t used;
+	int n;
+
+	for (n = 0; (n < DAEMON_LINES_MAX) && !c->closing; n++)
+	{
+		eol = strchr(c->in, '\n');
+		if (NULL == eol)
+		{
+			return;
+		}
+		*eol = 0;
+		daemonExecute(c, c->in, handler);
+		used = eol + 1 - c->in;
+		memmove(c->in, eol + 1, c->inLen - used + 1);
+		c->inLen -= used;
+	}
+}
+
+static void daemonDrop(int ep, DaemonClientType **clients, int idx)
+{
+	DaemonClientType *c = clients[idx];
+
+	epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	free(c->out);
+	free(c);
+	clients[idx] = NULL;
+}
+
+/*
+ * daemonListen:
+ *	The socket is 0660: only root and the members of "group", if given, can
+ *	connect. The umask keeps it closed between bind() and chown()
+ */
+static int daemonListen(const char *path, const char *group)
+{
+	struct sockaddr_un addr;
+	struct group *gr = NULL;
+	mode_t mask;
+	int fd;
+	int ret;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		printf("Socket path too long\n");
+		return -1;
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+	{
+		printf("Fail to create the socket\n");
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (NULL != group)
+	{
+		gr = getgrnam(group);
+		if (NULL == gr)
+		{
+			printf("Unknown group \"%s\"\n", group);
+			close(fd);
+			return -1;
+		}
+	}
+	unlink(path);
+	mask = umask(0177);
+	ret = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+	umask(mask);
+	if ( (ret < 0) || ( (NULL != gr) && (chown(path, (uid_t)-1, gr->gr_gid) < 0))
+		|| (chmod(path, 0660) < 0) || (listen(fd, DAEMON_BACKLOG) < 0)
+		|| (daemonNonBlock(fd) < 0))
+	{
+		printf("Fail to listen on %s\n", path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int daemonRun(const char *path, const char *group, DaemonHandlerType handler)
+{
+	DaemonClientType *clients[DAEMON_CLIENTS_MAX];
+	struct epoll_event ev;
+	struct epoll_event events[DAEMON_EVENTS];
+	DaemonClientType *c = NULL;
+	int lsn;
+	int ep;
+	int n;
+	int i;
+	int idx;
+	int fd;
+	int more;
+
+	memset(clients, 0, sizeof(clients));
+	lsn = daemonListen(path, group);
+	if (lsn < 0)
+	{
+		return ERROR;
+	}
+	ep = epoll_create1(0);
+	if (ep < 0)
+	{
+		close(lsn);
+		unlink(path);
+		return ERROR;
+	}
+	ev.events = EPOLLIN;
+	ev.data.u32 = DAEMON_CLIENTS_MAX; // the listening socket
+	epoll_ctl(ep, EPOLL_CTL_ADD, lsn, &ev);
+	signal(SIGINT, daemonSignal);
+	signal(SIGTERM, daemonSignal);
+	signal(SIGPIPE, SIG_IGN);
+
+	while (!gStop)
+	{
+		n = epoll_wait(ep, events, DAEMON_EVENTS, -1);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+		for (i = 0; i < n; i++)
+		{
+			idx = events[i].data.u32;
+			if (idx == DAEMON_CLIENTS_MAX)
+			{
+				while ( (fd = accept(lsn, NULL, NULL)) >= 0)
+				{
+					for (idx = 0; (idx < DAEMON_CLIENTS_MAX) && (NULL != clients[idx]);
+						idx++)
+						;
+					c = idx < DAEMON_CLIENTS_MAX ? calloc(1, sizeof(DaemonClientType)) :
+						NULL;
+					if ( (NULL == c) || (daemonNonBlock(fd) < 0))
+					{
+						free(c);
+						close(fd);
+						continue;
+					}
+					c->fd = fd;
+					clients[idx] = c;
+					ev.events = EPOLLIN;
+					ev.data.u32 = idx;
+					epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+				}
+				continue;
+			}
+			c = clients[idx];
+			if (NULL == c)
+			{
+				continue;
+			}
+			// a new request is read only when the previous answers are sent
+			more = NULL != strchr(c->in, '\n');
+			if (!c->closing && (c->outLen == 0) && !more
+				&& (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+			{
+				daemonRead(c);
+			}
+			if (!c->closing && (c->outLen == 0))
+			{
+				daemonLines(c, handler);
+			}
+			daemonFlush(c);
+			if (c->closing && (c->outLen == 0))
+			{
+				daemonDrop(ep, clients, idx);
+				continue;
+			}
+			// writable wakes it up again for the requests left in the buffer
+			more = NULL != strchr(c->in, '\n');
+			ev.events = (c->closing || (c->outLen > 0) || more) ? EPOLLOUT :
+				EPOLLIN;
+			ev.data.u32 = idx;
+			epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);
+		}
+	}
+	for (i = 0; i < DAEMON_CLIENTS_MAX; i++)
+	{
+		if (NULL != clients[i])
+		{
+			daemonDrop(ep, clients, i);
+		}
+	}
+	close(ep);
+	close(lsn);
+	unlink(path);
+	return OK;
+}
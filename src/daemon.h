@@ -0,0 +1,21 @@
+#ifndef DAEMON_H_
+#define DAEMON_H_
+
+#define DAEMON_SOCKET_PATH	"/run/8mosind.sock"
+
+// handler return value for a line without command, no status is sent back
+#define DAEMON_EMPTY	1
+
+/*
+ * Called for every received line with stdout redirected to the client,
+ * return OK or FAIL
+ */
+typedef int (*DaemonHandlerType)(char *line);
+
+/*
+ * Serve "path" until SIGINT/SIGTERM; the socket is accessible to root and to
+ * the members of "group" (NULL for root only)
+ */
+int daemonRun(const char *path, const char *group, DaemonHandlerType handler);
+
+#endif //DAEMON_H_
@@ -0,0 +1,418 @@
+/*
+ * emu.c:
+ *	Software model of the 8-MOSFETS card register map, used as transport
+ *	backend to run the command line without hardware
+ *
+ *	Copyright (c) 2016-2023 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ *	Author: Alexandru Burcea
+ ***********************************************************************
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mosfet.h"
+#include "comm.h"
+#include "emu.h"
+
+#define EMU_MAGIC		0x534f4d38
+#define EMU_SLAVE_NR	128
+#define EMU_MEM_SIZE	256
+#define EMU_SPEC_SIZE	64
+
+#define EMU_DEFAULT_3V3_MV	3300
+#define EMU_DEFAULT_TEMP	32
+#define EMU_DEFAULT_FREQ	200
+#define EMU_HW_MAJOR	5
+#define EMU_HW_MINOR	0
+#define EMU_FW_MAJOR	1
+#define EMU_FW_MINOR	2
+
+/*
+ * Board image shared by all the processes that use the same MOSIND_EMU_FILE
+ */
+typedef struct
+{
+	uint32_t magic;
+	char spec[EMU_SPEC_SIZE];
+	uint8_t present[EMU_SLAVE_NR];
+	uint8_t extended[EMU_SLAVE_NR];
+	uint8_t mem[EMU_SLAVE_NR][EMU_MEM_SIZE];
+} EmuImageType;
+
+typedef struct
+{
+	EmuImageType* img;
+	int mapped;
+	long latencyUs;
+	long byteUs;
+	double nackPct;
+	uint8_t stuckHi;
+	uint8_t stuckLo;
+	unsigned int seed;
+	int stats;
+	unsigned long transactions;
+	unsigned long bytes;
+	unsigned long nacks;
+} EmuBusType;
+
+static long emuEnvLong(const char* name, long def)
+{
+	char* val = secure_getenv(name);
+
+	if (NULL == val)
+	{
+		return def;
+	}
+	return strtol(val, NULL, 0);
+}
+
+static void emuBoardInit(EmuImageType* img, int addr, int extended)
+{
+	uint8_t* mem = img->mem[addr];
+	uint16_t raw = 0;
+
+	memset(mem, 0, EMU_MEM_SIZE);
+	img->present[addr] = 1;
+	img->extended[addr] = extended;
+	mem[I2C_OUTPORT_REG_ADD] = 0xff;
+	mem[I2C_CFG_REG_ADD] = 0xff; // power-up: all pins inputs
+	if (!extended)
+	{
+		return;
+	}
+	raw = EMU_DEFAULT_3V3_MV;
+	memcpy(&mem[I2C_MEM_DIAG_3V3_MV_ADD], &raw, 2);
+	mem[I2C_MEM_DIAG_TEMPERATURE_ADD] = EMU_DEFAULT_TEMP;
+	raw = EMU_DEFAULT_FREQ;
+	memcpy(&mem[I2C_PWM_FREQ], &raw, 2);
+	mem[I2C_MEM_REVISION_HW_MAJOR_ADD] = EMU_HW_MAJOR;
+	mem[I2C_MEM_REVISION_HW_MINOR_ADD] = EMU_HW_MINOR;
+	mem[I2C_MEM_REVISION_MAJOR_ADD] = EMU_FW_MAJOR;
+	mem[I2C_MEM_REVISION_MINOR_ADD] = EMU_FW_MINOR;
+}
+
+/*
+ * emuImageInit:
+ *	Populate the boards from MOSIND_EMU_BOARDS, a comma separated list of
+ *	stack levels with optional suffixes: 'a' answer on the alternate base
+ *	address, 'x' plain I/O expander without the extended memory.
+ *	Default "0": one extended board on the primary address at stack level 0
+ */
+static void emuImageInit(EmuImageType* img, const char* spec)
+{
+	const char* p = spec;
+	int stack;
+	int base;
+	int extended;
+
+	memset(img, 0, sizeof(EmuImageType));
+	img->magic = EMU_MAGIC;
+	strncpy(img->spec, spec, EMU_SPEC_SIZE - 1);
+
+	while (*p != 0)
+	{
+		if ( (*p < '0') || (*p > '7'))
+		{
+			p++;
+			continue;
+		}
+		stack = *p - '0';
+		base = MOSFET8_HW_I2C_BASE_ADD;
+		extended = 1;
+		p++;
+		while ( (*p != 0) && (*p != ','))
+		{
+			if ( (*p == 'a') || (*p == 'A'))
+			{
+				base = MOSFET8_HW_I2C_ALTERNATE_BASE_ADD;
+			}
+			else if ( (*p == 'x') || (*p == 'X'))
+			{
+				extended = 0;
+			}
+			p++;
+		}
+		emuBoardInit(img, (base + stack) ^ 0x07, extended);
+	}
+}
+
+/*
+ * emuFileOpen:
+ *	Open the image file, never through a symbolic link; an existing file is
+ *	used only if it is empty or already an emulator image
+ */
+static int emuFileOpen(const char* file)
+{
+	struct stat st;
+	uint32_t magic = 0;
+	int fd = open(file, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0666);
+
+	if (fd < 0)
+	{
+		return -1;
+	}
+	if ( (fstat(fd, &st) < 0) || !S_ISREG(st.st_mode)
+		|| ( (st.st_size != 0)
+			&& ( (pread(fd, &magic, sizeof(magic), 0) != sizeof(magic))
+				|| (magic != EMU_MAGIC))))
+	{
+		printf("%s is not an emulator image\n", file);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void* emuOpen(int bus)
+{
+	EmuBusType* eb = NULL;
+	const char* spec = secure_getenv("MOSIND_EMU_BOARDS");
+	const char* file = secure_getenv("MOSIND_EMU_FILE");
+	char* val = NULL;
+	int fd;
+
+	if (bus != 1)
+	{
+		printf("Failed to open the bus.");
+		return NULL;
+	}
+	if (NULL == spec)
+	{
+		spec = "0";
+	}
+	eb = calloc(1, sizeof(EmuBusType));
+	if (NULL == eb)
+	{
+		return NULL;
+	}
+	if (NULL != file)
+	{
+		fd = emuFileOpen(file);
+		if ( (fd < 0) || (ftruncate(fd, sizeof(EmuImageType)) < 0))
+		{
+			printf("Failed to open the emulator image %s\n", file);
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+			free(eb);
+			return NULL;
+		}
+		eb->img = mmap(NULL, sizeof(EmuImageType), PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, 0);
+		close(fd);
+		if (MAP_FAILED == eb->img)
+		{
+			free(eb);
+			return NULL;
+		}
+		eb->mapped = 1;
+		if ( (eb->img->magic != EMU_MAGIC)
+			|| (strncmp(eb->img->spec, spec, EMU_SPEC_SIZE - 1) != 0))
+		{
+			emuImageInit(eb->img, spec);
+		}
+	}
+	else
+	{
+		eb->img = malloc(sizeof(EmuImageType));
+		if (NULL == eb->img)
+		{
+			free(eb);
+			return NULL;
+		}
+		emuImageInit(eb->img, spec);
+	}
+	eb->latencyUs = emuEnvLong("MOSIND_EMU_LATENCY_US", 0);
+	eb->byteUs = emuEnvLong("MOSIND_EMU_BYTE_US", 0);
+	eb->stuckHi = 0xff & emuEnvLong("MOSIND_EMU_STUCK_HI", 0);
+	eb->stuckLo = 0xff & emuEnvLong("MOSIND_EMU_STUCK_LO", 0);
+	eb->seed = (unsigned int)emuEnvLong("MOSIND_EMU_SEED", 1);
+	eb->stats = (int)emuEnvLong("MOSIND_EMU_STATS", 0);
+	val = secure_getenv("MOSIND_EMU_NACK_PCT");
+	if (NULL != val)
+	{
+		eb->nackPct = atof(val);
+	}
+	return eb;
+}
+
+static void emuClose(void* ctx)
+{
+	EmuBusType* eb = ctx;
+
+	if (eb->stats)
+	{
+		fprintf(stderr, "emu: %lu transactions, %lu bytes, %lu nacks\n",
+			eb->transactions, eb->bytes, eb->nacks);
+	}
+	if (eb->mapped)
+	{
+		munmap(eb->img, sizeof(EmuImageType));
+	}
+	else
+	{
+		free(eb->img);
+	}
+	free(eb);
+}
+
+/*
+ * emuTransaction:
+ *	Account one bus transaction, apply the configured timing and decide if the
+ *	slave acknowledge it. Return 0 on ACK, -1 on NACK
+ */
+static int emuTransaction(EmuBusType* eb, int addr, int add, int size)
+{
+	struct timespec ts;
+	long us = eb->latencyUs + eb->byteUs * (size + 2);
+
+	eb->transactions++;
+	eb->bytes += size + 2;
+	if (us > 0)
+	{
+		ts.tv_sec = us / 1000000;
+		ts.tv_nsec = (us % 1000000) * 1000;
+		nanosleep(&ts, NULL);
+	}
+	if ( (addr < 0) || (addr >= EMU_SLAVE_NR) || !eb->img->present[addr]
+		|| (!eb->img->extended[addr] && (add > I2C_CFG_REG_ADD))
+		|| ( (eb->nackPct > 0)
+			&& (100.0 * rand_r(&eb->seed) / RAND_MAX < eb->nackPct)))
+	{
+		eb->nacks++;
+		errno = ENXIO;
+		return -1;
+	}
+	return 0;
+}
+
+static uint8_t emuRegRead(EmuImageType* img, int addr, int add)
+{
+	uint8_t* mem = img->mem[addr];
+	uint8_t pins;
+
+	if (add == I2C_INPORT_REG_ADD)
+	{
+		// outputs reflect the output latch, inputs are pulled up
+		pins = (mem[I2C_OUTPORT_REG_ADD] & ~mem[I2C_CFG_REG_ADD])
+			| mem[I2C_CFG_REG_ADD];
+		return pins ^ mem[I2C_POLINV_REG_ADD];
+	}
+	return mem[add];
+}
+
+static int emuRegWritable(int add)
+{
+	if ( (add >= I2C_OUTPORT_REG_ADD) && (add <= I2C_CFG_REG_ADD))
+	{
+		return 1;
+	}
+	if ( (add >= I2C_MEM_PWM1) && (add < I2C_PWM_FREQ + 2))
+	{
+		return 1;
+	}
+	return 0;
+}
+
+static int emuRead(void* ctx, int addr, int add, uint8_t* buff, int size)
+{
+	EmuBusType* eb = ctx;
+	int i;
+
+	if (emuTransaction(eb, addr, add, size) < 0)
+	{
+		return -1;
+	}
+	for (i = 0; i < size; i++)
+	{
+		buff[i] = emuRegRead(eb->img, addr, add);
+		// the extended firmware auto-increments, the expander repeats the register
+		if (eb->img->extended[addr])
+		{
+			add = (add + 1) % EMU_MEM_SIZE;
+		}
+	}
+	return 0;
+}
+
+static int emuProbe(void* ctx, int addr)
+{
+	return emuTransaction(ctx, addr, I2C_INPORT_REG_ADD, 0);
+}
+
+static int emuWrite(void* ctx, int addr, int add, const uint8_t* buff,
+	int size)
+{
+	EmuBusType* eb = ctx;
+	uint8_t* mem = NULL;
+	int i;
+
+	if (emuTransaction(eb, addr, add, size) < 0)
+	{
+		return -1;
+	}
+	mem = eb->img->mem[addr];
+	for (i = 0; i < size; i++)
+	{
+		if (emuRegWritable(add))
+		{
+			mem[add] = buff[i];
+		}
+		if (add == I2C_OUTPORT_REG_ADD)
+		{
+			mem[add] = (mem[add] | eb->stuckHi) & ~eb->stuckLo;
+		}
+		if (eb->img->extended[addr])
+		{
+			add = (add + 1) % EMU_MEM_SIZE;
+		}
+	}
+	return 0;
+}
+
+/*
+ * emuWriteMulti:
+ *	Model of a combined transfer: the latency is paid once, the bytes and the
+ *	acknowledge of every message as usual
+ */
+static int emuWriteMulti(void* ctx, const int* addr, const int* add,
+	const uint8_t* const* buff, const int* size, int count)
+{
+	EmuBusType* eb = ctx;
+	long latencyUs = eb->latencyUs;
+	int ret = 0;
+	int i;
+
+	for (i = 0; (i < count) && (ret == 0); i++)
+	{
+		ret = emuWrite(ctx, addr[i], add[i], buff[i], size[i]);
+		eb->latencyUs = 0;
+	}
+	eb->latencyUs = latencyUs;
+	return ret;
+}
+
+const I2cBackendType gI2cEmuBackend =
+{
+	"emu",
+	&emuOpen,
+	&emuClose,
+	&emuRead,
+	&emuWrite,
+	NULL,
+	NULL,
+	&emuProbe,
+	&emuWriteMulti
+};
@@ -0,0 +1,21 @@
+#ifndef EMU_H_
+#define EMU_H_
+
+#include "comm.h"
+
+/*
+ * In-memory 8-MOSFETS board model, configured from the environment:
+ *	MOSIND_EMU_BOARDS      stack levels present, ex: "0,1a,2x" (a = alternate
+ *	                       base address, x = plain I/O expander), default "0"
+ *	MOSIND_EMU_FILE        share the board image between processes (mmap)
+ *	MOSIND_EMU_LATENCY_US  delay added to every transaction
+ *	MOSIND_EMU_BYTE_US     delay added for every byte on the bus
+ *	MOSIND_EMU_NACK_PCT    probability [%] for a transaction to be NACKed
+ *	MOSIND_EMU_SEED        seed for the fault injection
+ *	MOSIND_EMU_STUCK_HI    output port bits stuck at 1
+ *	MOSIND_EMU_STUCK_LO    output port bits stuck at 0
+ *	MOSIND_EMU_STATS       print the transaction counters on close
+ */
+extern const I2cBackendType gI2cEmuBackend;
+
+#endif //EMU_H_
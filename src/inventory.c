@@ -0,0 +1,309 @@
+/*
+ * inventory.c:
+ *	Board discovery cache: the address, the variant and the init state of
+ *	every stack level are kept in a file, so the next runs do not probe again
+ *
+ *	Copyright (c) 2016-2023 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ *	Author: Alexandru Burcea
+ ***********************************************************************
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "mosfet.h"
+#include "inventory.h"
+
+#define INVENTORY_FALLBACK_DIR	"/tmp/8mosind-"	/* + real uid */
+#define INVENTORY_FILE	"inventory"
+#define INVENTORY_BOOT_ID	"/proc/sys/kernel/random/boot_id"
+#define INVENTORY_BOOT_SIZE	40
+
+// directory of the inventory file, empty string = no cache
+static char gDir[128] = INVENTORY_DIR;
+static const char *gResolved = NULL;
+static char gFallback[64];
+
+static char gBoot[INVENTORY_BOOT_SIZE];
+
+static InventoryEntryType gInv[INVENTORY_LEVELS];
+static int gLoaded = 0;
+static unsigned int gDirty = 0; // stack levels changed by this process
+
+/*
+ * inventoryConfig:
+ *	Select the directory of the inventory file, NULL or "" disable the cache
+ */
+void inventoryConfig(const char *dir)
+{
+	if (NULL == dir)
+	{
+		dir = "";
+	}
+	strncpy(gDir, dir, sizeof(gDir) - 1);
+	gDir[sizeof(gDir) - 1] = 0;
+	gResolved = NULL;
+	gLoaded = 0;
+	gDirty = 0;
+}
+
+/*
+ * inventoryDirOk:
+ *	The directory is used only if nobody else can have written the file: a
+ *	real directory owned by root or by this process, not writable by others
+ */
+static int inventoryDirOk(const char *dir, mode_t mode)
+{
+	struct stat st;
+
+	if ( (mkdir(dir, mode) < 0) && (errno != EEXIST))
+	{
+		return 0;
+	}
+	return (lstat(dir, &st) == 0) && S_ISDIR(st.st_mode)
+		&& ( (st.st_uid == 0) || (st.st_uid == geteuid()))
+		&& ( (st.st_mode & (S_IWGRP | S_IWOTH)) == 0);
+}
+
+/*
+ * inventoryDir:
+ *	The configured directory, created if missing; the default one falls back
+ *	to a private INVENTORY_FALLBACK_DIR<uid> when /run is not writable
+ */
+static const char* inventoryDir(void)
+{
+	if (NULL != gResolved)
+	{
+		return gResolved;
+	}
+	if (gDir[0] == 0)
+	{
+		return NULL;
+	}
+	if (inventoryDirOk(gDir, 0755) && (faccessat(AT_FDCWD, gDir, W_OK, AT_EACCESS) == 0))
+	{
+		gResolved = gDir;
+		return gResolved;
+	}
+	if (strcmp(gDir, INVENTORY_DIR) != 0)
+	{
+		return NULL;
+	}
+	snprintf(gFallback, sizeof(gFallback), "%s%u", INVENTORY_FALLBACK_DIR,
+		(unsigned)getuid());
+	if (inventoryDirOk(gFallback, 0700))
+	{
+		gResolved = gFallback;
+	}
+	return gResolved;
+}
+
+/*
+ * inventoryBoot:
+ *	The id of the running kernel boot, "" if unknown
+ */
+static const char* inventoryBoot(void)
+{
+	FILE *f = NULL;
+
+	if (gBoot[0] != 0)
+	{
+		return gBoot;
+	}
+	f = fopen(INVENTORY_BOOT_ID, "r");
+	if (NULL == f)
+	{
+		return gBoot;
+	}
+	if (1 != fscanf(f, "%39s", gBoot))
+	{
+		gBoot[0] = 0;
+	}
+	fclose(f);
+	return gBoot;
+}
+
+/*
+ * inventoryRead:
+ *	Parse the file, a "# boot <id>" line then one "<stack> <address>
+ *	<extended> <initialized>" line for every known stack level; the address
+ *	must be one of the two the board of that stack level can answer on.
+ *	The cards lose their configuration on a power cycle, so "initialized" is
+ *	trusted only if the file was written since the last boot, a /tmp on disk
+ *	keeps it across reboots
+ */
+static void inventoryRead(InventoryEntryType *inv)
+{
+	const char *dir = inventoryDir();
+	const char *boot = inventoryBoot();
+	char path[sizeof(gDir) + 32];
+	char line[128];
+	char fileBoot[INVENTORY_BOOT_SIZE];
+	FILE *f = NULL;
+	int sameBoot = 0;
+	int stack;
+	int add;
+	int extended;
+	int initialized;
+
+	memset(inv, 0, INVENTORY_LEVELS * sizeof(InventoryEntryType));
+	if (NULL == dir)
+	{
+		return;
+	}
+	snprintf(path, sizeof(path), "%s/%s", dir, INVENTORY_FILE);
+	f = fopen(path, "r");
+	if (NULL == f)
+	{
+		return;
+	}
+	while (NULL != fgets(line, sizeof(line), f))
+	{
+		if (1 == sscanf(line, "# boot %39s", fileBoot))
+		{
+			sameBoot = (boot[0] != 0) && (strcmp(fileBoot, boot) == 0);
+			continue;
+		}
+		if ( (sscanf(line, "%d %i %d %d", &stack, &add, &extended, &initialized)
+			!= 4) || (stack < 0) || (stack >= INVENTORY_LEVELS)
+			|| ( (add != ( (MOSFET8_HW_I2C_BASE_ADD + stack) ^ 0x07))
+				&& (add != ( (MOSFET8_HW_I2C_ALTERNATE_BASE_ADD + stack) ^ 0x07))))
+		{
+			continue; // comment or damaged line
+		}
+		inv[stack].valid = 1;
+		inv[stack].hwAdd = add;
+		inv[stack].extended = extended;
+		inv[stack].initialized = sameBoot && initialized;
+	}
+	fclose(f);
+}
+
+static void inventoryLoad(void)
+{
+	if (!gLoaded)
+	{
+		inventoryRead(gInv);
+		gLoaded = 1;
+	}
+}
+
+/*
+ * inventoryGet:
+ *	Return OK and fill "entry" if the stack level is in the cache
+ */
+int inventoryGet(int stack, InventoryEntryType *entry)
+{
+	if ( (stack < 0) || (stack >= INVENTORY_LEVELS) || (NULL == entry))
+	{
+		return ERROR;
+	}
+	inventoryLoad();
+	if (!gInv[stack].valid)
+	{
+		return ERROR;
+	}
+	memcpy(entry, &gInv[stack], sizeof(InventoryEntryType));
+	return OK;
+}
+
+void inventorySet(int stack, const InventoryEntryType *entry)
+{
+	if ( (stack < 0) || (stack >= INVENTORY_LEVELS) || (NULL == entry))
+	{
+		return;
+	}
+	inventoryLoad();
+	if (gInv[stack].valid && (gInv[stack].hwAdd == entry->hwAdd)
+		&& (gInv[stack].extended == entry->extended)
+		&& (gInv[stack].initialized == entry->initialized))
+	{
+		return;
+	}
+	memcpy(&gInv[stack], entry, sizeof(InventoryEntryType));
+	gInv[stack].valid = 1;
+	gDirty |= 1u << stack;
+}
+
+void inventoryDrop(int stack)
+{
+	if ( (stack < 0) || (stack >= INVENTORY_LEVELS))
+	{
+		return;
+	}
+	inventoryLoad();
+	if (gInv[stack].valid)
+	{
+		gInv[stack].valid = 0;
+		gDirty |= 1u << stack;
+	}
+}
+
+/*
+ * inventoryFlush:
+ *	Write back the stack levels changed by this process. The file is read
+ *	again first to keep what other processes stored meanwhile, then replaced
+ *	with rename() so a reader never sees a partial file
+ */
+int inventoryFlush(void)
+{
+	InventoryEntryType inv[INVENTORY_LEVELS];
+	const char *dir = inventoryDir();
+	char path[sizeof(gDir) + 32];
+	char tmp[sizeof(gDir) + 32];
+	FILE *f = NULL;
+	int fd;
+	int i;
+
+	if ( (gDirty == 0) || (NULL == dir))
+	{
+		return OK;
+	}
+	inventoryRead(inv);
+	for (i = 0; i < INVENTORY_LEVELS; i++)
+	{
+		if (gDirty & (1u << i))
+		{
+			memcpy(&inv[i], &gInv[i], sizeof(InventoryEntryType));
+		}
+	}
+	snprintf(path, sizeof(path), "%s/%s", dir, INVENTORY_FILE);
+	snprintf(tmp, sizeof(tmp), "%s/%s.XXXXXX", dir, INVENTORY_FILE);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+	{
+		return ERROR;
+	}
+	fchmod(fd, 0644);
+	f = fdopen(fd, "w");
+	if (NULL == f)
+	{
+		close(fd);
+		unlink(tmp);
+		return ERROR;
+	}
+	fprintf(f, "# boot %s\n", inventoryBoot());
+	fprintf(f, "# stack address extended initialized\n");
+	for (i = 0; i < INVENTORY_LEVELS; i++)
+	{
+		if (inv[i].valid)
+		{
+			fprintf(f, "%d 0x%02x %d %d\n", i, inv[i].hwAdd, inv[i].extended,
+				inv[i].initialized);
+		}
+	}
+	if ( (fclose(f) != 0) || (rename(tmp, path) < 0))
+	{
+		unlink(tmp);
+		return ERROR;
+	}
+	gDirty = 0;
+	return OK;
+}
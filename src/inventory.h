@@ -0,0 +1,24 @@
+#ifndef INVENTORY_H_
+#define INVENTORY_H_
+
+#define INVENTORY_DIR	"/run/8mosind"
+#define INVENTORY_LEVELS	8
+
+/*
+ * What a previous run learned about one stack level
+ */
+typedef struct
+{
+	int valid;
+	int hwAdd; // 7 bit slave address the board answered on
+	int extended; // -1 unknown, 0 plain I/O expander, 1 extended memory
+	int initialized; // 1 if the I/O pins were found or made outputs
+} InventoryEntryType;
+
+void inventoryConfig(const char *dir);
+int inventoryGet(int stack, InventoryEntryType *entry);
+void inventorySet(int stack, const InventoryEntryType *entry);
+void inventoryDrop(int stack);
+int inventoryFlush(void);
+
+#endif //INVENTORY_H_
@@ -8,43 +8,50 @@
  *	Author: Alexandru Burcea
  ***********************************************************************
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 
+#include "mosind.h"
 #include "mosfet.h"
 #include "comm.h"
+#include "daemon.h"
+#include "inventory.h"
+#include "pattern.h"
+#include "chmap.h"
+#include "telemetry.h"
 #include "thread.h"
+#include "retry.h"
+#include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <semaphore.h>
 #include <time.h>
 #include <errno.h>
+#include <math.h>
 
 #define VERSION_BASE	(int)1
 #define VERSION_MAJOR	(int)0
 #define VERSION_MINOR	(int)7
 
 #define UNUSED(X) (void)X      /* To avoid gcc/g++ warnings */
-#define CMD_ARRAY_SIZE	18
+#define CMD_ARRAY_SIZE	24
 
-#define THREAD_SAFE
+//#define LEGACY_SEM /* also hold /SMI2C_SEM for the whole command, as the older tools do */
 //#define DEBUG_SEM
 #define TIMEOUT_S 3
 
-#define MOS_MIN_FREQ 16
-#define MOS_MAX_FREQ 1000
+#define TEST_STEP_US	150000
 
-const u8 mosfetMaskRemap[8] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80};
-const int mosfetChRemap[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+#define LATENCY_CYCLES		10000
+#define LATENCY_CYCLES_MAX	10000000
 
-int mosfetChSet(int dev, u8 channel, OutStateEnumType state);
-int mosfetChGet(int dev, u8 channel, OutStateEnumType *state);
-u8 mosfetToIO(u8 mosfet);
-u8 IOToMosfet(u8 io);
-int cfg485Set(int dev, u8 mode, u32 baud, u8 stopB, u8 parity, u8 add);
-int cfg485Get(int dev);
+#define TELEMETRY_RATE_MAX	10000
+
+// real-time settings of the thread that talks to the boards, MOSIND_RT_*
+static RtConfigType gRt = {0, 0, 0};
 
 static int doHelp(int argc, char *argv[]);
 const CliCmdType CMD_HELP =
@@ -69,8 +76,8 @@ const CliCmdType CMD_WAR = {"-warranty", 1, &doWarranty,
 static int doList(int argc, char *argv[]);
 const CliCmdType CMD_LIST =
 	{"-list", 1, &doList,
-		"\t-list:       List all 8mosind boards connected,\n\treturn       nr of boards and stack level for every board\n",
-		"\tUsage:       8mosind -list\n", "",
+		"\t-list:       List all 8mosind boards connected,\n\treturn       nr of boards and stack level for every board\n\t            followed by the address and the revision of every board\n",
+		"\tUsage:       8mosind -list [pa|ap|p|a]  (address order: primary, alternate)\n", "",
 		"\tExample:     8mosind -list display: 1,0 \n"};
 
 static int doMosfetWrite(int argc, char *argv[]);
@@ -89,16 +96,16 @@ const CliCmdType CMD_READ = {"read", 2, &doMosfetRead,
 
 static int doMosfetPWMWrite(int argc, char *argv[]);
 const CliCmdType CMD_PWM_WRITE = {"pwmwr", 2, &doMosfetPWMWrite,
-	"\tpwmwr:       Set one mosfet pwm fill facor\n",
+	"\tpwmwr:       Set one or all mosfets pwm fill facor\n",
 	"\tUsage:       8mosind <id> pwmwr <channel> <0..100>\n",
-	"",
+	"\tUsage:       8mosind <id> pwmwr all <ch1> <ch2> <ch3> <ch4> <ch5> <ch6> <ch7> <ch8>\n",
 	"\tExample:     8mosind 0 pwmwr 2 45; Set Mosfet #2 on Board #0 pwm fill factor to 45%\n"};
 
 static int doMosfetPWMRead(int argc, char *argv[]);
 const CliCmdType CMD_PWM_READ = {"pwmrd", 2, &doMosfetPWMRead,
-	"\tpwmrd:       Read one channel pwm fill factor\n",
+	"\tpwmrd:       Read one or all channels pwm fill factor\n",
 	"\tUsage:       8mosind <id> pwmrd <channel>\n",
-	"",
+	"\tUsage:       8mosind <id> pwmrd all\n",
 	"\tExample:     8mosind 0 pwmrd 2; Read pwm fill factor of Mosfet #2 on Board #0\n"};
 
 static int doMosfetFreqWr(int argc, char *argv[]);
@@ -116,6 +123,77 @@ const CliCmdType CMD_F_READ =
 
 
 
+static int doLatency(int argc, char *argv[]);
+const CliCmdType CMD_LATENCY =
+	{"latency", 2, &doLatency,
+		"\tlatency:     Measure back to back output port read/write cycles\n",
+		"\tUsage:       8mosind <id> latency [<cycles>]\n",
+		"\t             default 10000 cycles, the real-time settings come from MOSIND_RT_*\n",
+		"\tExample:     MOSIND_RT_PRIO=80 MOSIND_RT_CPUS=3 MOSIND_RT_LOCK=1 8mosind 0 latency 100000; Print min/avg/p99/p99.9/max cycle time\n"};
+
+static int doSync(int argc, char *argv[]);
+const CliCmdType CMD_SYNC =
+	{"-sync", 1, &doSync,
+		"\t-sync:       Update the mosfets of several boards at the same time\n",
+		"\tUsage:       8mosind -sync <id>:<value>[:<pwm1>,..,<pwm8>] ..\n",
+		"\t             up to 8 boards, pwm in percent; print the measured skew between the boards\n",
+		"\tExample:     8mosind -sync 0:0x0f 1:0xf0 2:255:10,10,10,10,50,50,50,50; Switch boards #0, #1 and #2 together\n"};
+
+static int doMask(int argc, char *argv[]);
+const CliCmdType CMD_MASK =
+	{"-mask", 1, &doMask,
+		"\t-mask:       Set, clear, toggle or read logical channels 1..64 of the whole stack\n",
+		"\tUsage:       8mosind -mask <set|clr|toggle|read> <channels> [<channels>..]\n",
+		"\tUsage:       8mosind -mask groups; channels: 1-4,17 | 0x<64 bit mask> | <group>, groups from $MOSIND_GROUPS or " CHMAP_GROUPS_FILE "\n",
+		"\tExample:     8mosind -mask set 1-4,9 valves; Turn on mosfets 1..4 of board #0, mosfet 1 of board #1 and the \"valves\" group\n"};
+
+static int doDump(int argc, char *argv[]);
+const CliCmdType CMD_DUMP =
+	{"dump", 2, &doDump,
+		"\tdump:        Read the whole board register image in one transaction\n",
+		"\tUsage:       8mosind <id> dump\n", "",
+		"\tExample:     8mosind 0 dump; Display mosfets, pwm, frequency, diagnostics and RS485 settings of Board #0\n"};
+
+static int doBatch(int argc, char *argv[]);
+const CliCmdType CMD_BATCH =
+	{"-batch", 1, &doBatch,
+		"\t-batch:      Execute commands read from a file or stdin, one per line\n",
+		"\tUsage:       8mosind -batch [<file>]\n",
+		"\t             line format: <id> <command> <arguments>, # start a comment\n",
+		"\tExample:     printf \"0 write 1 on\\n0 read\\n\" | 8mosind -batch; Print the output of every line followed by \"<line nr>: ok\" or \"<line nr>: fail\"\n"};
+
+static int doDaemon(int argc, char *argv[]);
+const CliCmdType CMD_DAEMON =
+	{"-daemon", 1, &doDaemon,
+		"\t-daemon:     Serve the commands on a Unix domain socket, keep the boards initialized\n",
+		"\tUsage:       8mosind -daemon [<socket path>]\n",
+		"\t             default socket $MOSIND_SOCKET or " DAEMON_SOCKET_PATH ", same protocol as -batch; mode 0660, group $MOSIND_SOCKET_GROUP\n",
+		"\tExample:     8mosind -daemon & echo \"0 read\" | nc -U " DAEMON_SOCKET_PATH "; Print the mosfets state and \"1: ok\"\n"};
+
+static int doPlay(int argc, char *argv[]);
+const CliCmdType CMD_PLAY =
+	{"-play", 1, &doPlay,
+		"\t-play:       Play a compiled pattern file with absolute deadline timing\n",
+		"\tUsage:       8mosind -play <pattern file> [<repeat>]\n",
+		"\t             repeat 0 = loop until Ctrl-C; print the deadline misses and the jitter at the end\n",
+		"\tExample:     8mosind -play lights.bin 10; Play lights.bin ten times\n"};
+
+static int doCompile(int argc, char *argv[]);
+const CliCmdType CMD_COMPILE =
+	{"-compile", 1, &doCompile,
+		"\t-compile:    Compile a text pattern for -play\n",
+		"\tUsage:       8mosind -compile <text file> <pattern file>\n",
+		"\t             line format: <ms> <id> write <value> | <ms> <id> pwmwr <channel|all> <0..100>.., period <ms>\n",
+		"\tExample:     8mosind -compile lights.txt lights.bin\n"};
+
+static int doTelemetry(int argc, char *argv[]);
+const CliCmdType CMD_TELEMETRY =
+	{"-telemetry", 1, &doTelemetry,
+		"\t-telemetry:  Sample the mosfets state, the 3.3V rail and the temperature at a fixed rate\n",
+		"\tUsage:       8mosind -telemetry <all|<id>[,<id>..]> <rate Hz> [<seconds> [<file> [csv|bin]]]\n",
+		"\t             seconds 0 = until Ctrl-C, default file \"-\" (stdout) in CSV; print the dropped and missed samples at the end\n",
+		"\tExample:     8mosind -telemetry all 100 3600 thermal.csv; Log every board 100 times per second for one hour\n"};
+
 static int doTest(int argc, char *argv[]);
 const CliCmdType CMD_TEST = {"test", 2, &doTest,
 	"\ttest:        Turn ON and OFF the mosfets until press a key\n", "",
@@ -149,14 +227,25 @@ char *usage = "Usage:	 8mosind -h <command>\n"
 	"         8mosind -v\n"
 	"         8mosind -warranty\n"
 	"         8mosind -list\n"
+	"         8mosind -batch [<file>]\n"
+	"         8mosind -daemon [<socket path>]\n"
+	"         8mosind -play <pattern file> [<repeat>]\n"
+	"         8mosind -compile <text file> <pattern file>\n"
+	"         8mosind -sync <id>:<value>[:<pwm1>,..,<pwm8>] ..\n"
+	"         8mosind -mask <set|clr|toggle|read> <channels> ..\n"
+	"         8mosind -mask groups\n"
 	"         8mosind <id> write <channel> <on/off>\n"
 	"         8mosind <id> write <value>\n"
 	"         8mosind <id> read <channel>\n"
 	"         8mosind <id> read\n"
 	"         8mosind <id> pwmwr <channel> <0..100>\n"
+	"         8mosind <id> pwmwr all <ch1> .. <ch8>\n"
 	"         8mosind <id> pwmrd <channel>\n"
+	"         8mosind <id> pwmrd all\n"
 	"         8mosind <id> fwr <[16..1000]>\n"
 	"         8mosind <id> frd\n"
+	"         8mosind <id> dump\n"
+	"         8mosind <id> latency [<cycles>]\n"
 	"         8mosind <id> test\n"
 	"         8mosind <id> cfg485wr <mode> <baudrate> <stopBits> <parity> <slaveAddr>\n"
 	"         8mosind <id> cfg485rd\n"
@@ -178,339 +267,23 @@ char *warranty =
 		"			\n"
 		"		You should have received a copy of the GNU Lesser General Public License\n"
 		"		along with this program. If not, see <http://www.gnu.org/licenses/>.";
-u8 mosfetToIO(u8 mosfet)
-{
-	u8 i;
-	u8 val = 0;
-	for (i = 0; i < 8; i++)
-	{
-		if ( (mosfet & (1 << i)) != 0)
-			val += mosfetMaskRemap[i];
-	}
-	return 0xff ^ val;
-}
-
-u8 IOToMosfet(u8 io)
-{
-	u8 i;
-	u8 val = 0;
-
-	io ^= 0xff;
-	for (i = 0; i < 8; i++)
-	{
-		if ( (io & mosfetMaskRemap[i]) != 0)
-		{
-			val += 1 << i;
-		}
-	}
-	return val;
-}
-
-int mosfetChSet(int dev, u8 channel, OutStateEnumType state)
-{
-	int resp;
-	u8 buff[2];
-
-	if ( (channel < CHANNEL_NR_MIN) || (channel > MOSFET_CH_NR_MAX))
-	{
-		printf("Invalid mosfet nr!\n");
-		return ERROR;
-	}
-	if (FAIL == i2cMem8Read(dev, MOSFET8_OUTPORT_REG_ADD, buff, 1))
-	{
-		return FAIL;
-	}
-
-	switch (state)
-	{
-	case ON:
-		buff[0] &= ~ (1 << mosfetChRemap[channel - 1]);
-		resp = i2cMem8Write(dev, MOSFET8_OUTPORT_REG_ADD, buff, 1);
-		break;
-	case OFF:
-		buff[0] |= 1 << mosfetChRemap[channel - 1];
-		resp = i2cMem8Write(dev, MOSFET8_OUTPORT_REG_ADD, buff, 1);
-		break;
-	default:
-		printf("Invalid mosfet state!\n");
-		return ERROR;
-		break;
-	}
-	return resp;
-}
-
-int mosfetChSetPwm(int dev, u8 channel, float value)
+/*
+ * pwmPercentParse:
+ *	Convert a "0..100" fill factor argument to per-mille
+ */
+static u16 pwmPercentParse(const char *arg)
 {
-	u8 buff[2];
-	uint16_t raw = 0;
+	float value = atof(arg);
 
-	if ( (channel < CHANNEL_NR_MIN) || (channel > MOSFET_CH_NR_MAX))
-	{
-		printf("Invalid mosfet nr!\n");
-		return ERROR;
-	}
-	if(value > 100)
+	if (value > 100)
 	{
 		value = 100;
 	}
-	if(value < 0)
+	if (value < 0)
 	{
 		value = 0;
 	}
-	raw = (uint16_t)(value * 10);
-	memcpy(buff, &raw, 2);
-	return i2cMem8Write(dev, I2C_MEM_PWM1 + PWM_SIZE_B * (channel -1), buff, 2);
-
-}
-
-int mosfetChGet(int dev, u8 channel, OutStateEnumType *state)
-{
-	u8 buff[2];
-
-	if (NULL == state)
-	{
-		return ERROR;
-	}
-
-	if ( (channel < CHANNEL_NR_MIN) || (channel > MOSFET_CH_NR_MAX))
-	{
-		printf("Invalid mosfet nr!\n");
-		return ERROR;
-	}
-
-	if (FAIL == i2cMem8Read(dev, MOSFET8_OUTPORT_REG_ADD, buff, 1))
-	{
-		return ERROR;
-	}
-
-	if (buff[0] & (1 << mosfetChRemap[channel - 1]))
-	{
-		*state = OFF;
-	}
-	else
-	{
-		*state = ON;
-	}
-	return OK;
-}
-
-
-int mosfetChGetPwm(int dev, u8 channel, float *value)
-{
-	u8 buff[2];
-	uint16_t raw = 0;
-
-	if (NULL == value)
-	{
-		return ERROR;
-	}
-
-	if ( (channel < CHANNEL_NR_MIN) || (channel > MOSFET_CH_NR_MAX))
-	{
-		printf("Invalid mosfet nr!\n");
-		return ERROR;
-	}
-
-	if (FAIL == i2cMem8Read(dev, I2C_MEM_PWM1 + PWM_SIZE_B * (channel -1), buff, 2))
-	{
-		return ERROR;
-	}
-	memcpy(&raw, buff, 2);
-
-	*value = (float)raw / 10;
-
-	return OK;
-}
-
-int mosfetSet(int dev, int val)
-{
-	u8 buff[2];
-
-	buff[0] = mosfetToIO(0xff & val);
-
-	return i2cMem8Write(dev, MOSFET8_OUTPORT_REG_ADD, buff, 1);
-}
-
-int mosfetGet(int dev, int *val)
-{
-	u8 buff[2];
-
-	if (NULL == val)
-	{
-		return ERROR;
-	}
-	if (FAIL == i2cMem8Read(dev, MOSFET8_OUTPORT_REG_ADD, buff, 1))
-	{
-		return ERROR;
-	}
-	*val = IOToMosfet(buff[0]);
-	return OK;
-}
-
-
-int mosfetSetFrequency(int dev, int val)
-{
-	u8 buff[2];
-	uint16_t raw = 0;
-
-	if (val < MOS_MIN_FREQ || val > MOS_MAX_FREQ)
-	{
-		printf("Frequency out of range [%d..%d]\n", MOS_MIN_FREQ, MOS_MAX_FREQ);
-		return ERROR;
-	}
-	raw = (uint16_t)val;
-	memcpy(buff, &raw, 2);
-	return i2cMem8Write(dev, I2C_PWM_FREQ, buff, 2);
-}
-
-int mosfetGetFrequency(int dev, int *val)
-{
-	u8 buff[2];
-	uint16_t raw = 0;
-
-	if (NULL == val)
-	{
-		return ERROR;
-	}
-	if (FAIL == i2cMem8Read(dev, I2C_PWM_FREQ, buff, 2))
-	{
-		return ERROR;
-	}
-	memcpy(&raw, buff, 2);
-	*val = raw;
-
-	return OK;
-}
-
-int cfg485Set(int dev, u8 mode, u32 baud, u8 stopB, u8 parity, u8 add)
-{
-	ModbusSetingsType settings;
-	u8 buff[5];
-
-	if (baud > 921600 || baud < 1200)
-	{
-		printf("Invalid RS485 Baudrate [1200, 921600]!\n");
-		return ERROR;
-	}
-	if (mode > 1)
-	{
-		printf("Invalid RS485 mode : 0 = disable, 1= Modbus RTU (Slave)!\n");
-		return ERROR;
-	}
-	if (stopB < 1 || stopB > 2)
-	{
-		printf("Invalid RS485 stop bits [1, 2]!\n");
-		return ERROR;
-	}
-	if (parity > 2)
-	{
-		printf("Invalid RS485 parity 0 = none; 1 = even; 2 = odd! \n");
-		return ERROR;
-	}
-	if (add < 1)
-	{
-		printf("Invalid MODBUS device address: [1, 255]!\n");
-	}
-	settings.mbBaud = baud;
-	settings.mbType = mode;
-	settings.mbParity = parity;
-	settings.mbStopB = stopB;
-	settings.add = add;
-
-	memcpy(buff, &settings, sizeof(ModbusSetingsType));
-	if (OK != i2cMem8Write(dev, I2C_MODBUS_SETINGS_ADD, buff, 5))
-	{
-		printf("Fail to write RS485 settings!\n");
-		return ERROR;
-	}
-	return OK;
-}
-
-int cfg485Get(int dev)
-{
-	ModbusSetingsType settings;
-	u8 buff[5];
-
-	if (OK != i2cMem8Read(dev, I2C_MODBUS_SETINGS_ADD, buff, 5))
-	{
-		printf("Fail to read RS485 settings!\n");
-		return ERROR;
-	}
-	memcpy(&settings, buff, sizeof(ModbusSetingsType));
-	printf("<mode> <baudrate> <stopbits> <parity> <add> %d %d %d %d %d\n",
-		(int)settings.mbType, (int)settings.mbBaud, (int)settings.mbStopB,
-		(int)settings.mbParity, (int)settings.add);
-	return OK;
-}
-
-
-
-int doBoardInit(int stack)
-{
-	int dev = 0;
-	int add = 0;
-	uint8_t buff[8];
-
-	if ( (stack < 0) || (stack > 7))
-	{
-		printf("Invalid stack level [0..7]!");
-		return ERROR;
-	}
-	add = (stack + MOSFET8_HW_I2C_BASE_ADD) ^ 0x07;
-	dev = i2cSetup(add);
-	if (dev == -1)
-	{
-		return ERROR;
-	}
-	if (ERROR == i2cMem8Read(dev, MOSFET8_CFG_REG_ADD, buff, 1))
-	{
-		add = (stack + MOSFET8_HW_I2C_ALTERNATE_BASE_ADD) ^ 0x07;
-		dev = i2cSetup(add);
-		if (dev == -1)
-		{
-			return ERROR;
-		}
-		if (ERROR == i2cMem8Read(dev, MOSFET8_CFG_REG_ADD, buff, 1))
-		{
-			printf("8-MOSFETS card id %d not detected\n", stack);
-			return ERROR;
-		}
-	}
-	if (buff[0] != 0) //non initialized I/O Expander
-	{
-		// make all I/O pins output
-		buff[0] = 0;
-		if (0 > i2cMem8Write(dev, MOSFET8_CFG_REG_ADD, buff, 1))
-		{
-			return ERROR;
-		}
-		// put all pins in 0-logic state
-		buff[0] = 0xff;
-		if (0 > i2cMem8Write(dev, MOSFET8_OUTPORT_REG_ADD, buff, 1))
-		{
-			return ERROR;
-		}
-	}
-
-	return dev;
-}
-
-int boardCheck(int hwAdd)
-{
-	int dev = 0;
-	uint8_t buff[8];
-
-	hwAdd ^= 0x07;
-	dev = i2cSetup(hwAdd);
-	if (dev == -1)
-	{
-		return FAIL;
-	}
-	if (ERROR == i2cMem8Read(dev, MOSFET8_CFG_REG_ADD, buff, 1))
-	{
-		return ERROR;
-	}
-	return OK;
+	return (u16)(value * 10);
 }
 
 /*
@@ -523,10 +296,8 @@ static int doMosfetWrite(int argc, char *argv[])
 	int pin = 0;
 	OutStateEnumType state = STATE_COUNT;
 	int val = 0;
-	int dev = 0;
-	OutStateEnumType stateR = STATE_COUNT;
-	int valR = 0;
-	int retry = 0;
+	int ret = OK;
+	mosind_t *h = NULL;
 
 	if ( (argc != 5) && (argc != 4))
 	{
@@ -535,8 +306,8 @@ static int doMosfetWrite(int argc, char *argv[])
 		return (FAIL);
 	}
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	h = mosind_open(atoi(argv[1]));
+	if (NULL == h)
 	{
 		return (FAIL);
 	}
@@ -546,6 +317,7 @@ static int doMosfetWrite(int argc, char *argv[])
 		if ( (pin < CHANNEL_NR_MIN) || (pin > MOSFET_CH_NR_MAX))
 		{
 			printf("Mosfet number value out of range\n");
+			mosind_close(h);
 			return (FAIL);
 		}
 
@@ -560,37 +332,17 @@ static int doMosfetWrite(int argc, char *argv[])
 			if ( (atoi(argv[4]) >= STATE_COUNT) || (atoi(argv[4]) < 0))
 			{
 				printf("Invalid mosfet state!\n");
+				mosind_close(h);
 				return (FAIL);
 			}
 			state = (OutStateEnumType)atoi(argv[4]);
 		}
 
-		retry = RETRY_TIMES;
-
-		while ( (retry > 0) && (stateR != state))
-		{
-			if (OK != mosfetChSet(dev, pin, state))
-			{
-				printf("Fail to write mosfet\n");
-				return (FAIL);
-			}
-			if (OK != mosfetChGet(dev, pin, &stateR))
-			{
-				printf("Fail to read mosfet\n");
-				return (FAIL);
-			}
-			retry--;
-		}
-#ifdef DEBUG_I
-		if(retry < RETRY_TIMES)
-		{
-			printf("retry %d times\n", 3-retry);
-		}
-#endif
-		if (retry == 0)
+		if (OK != mosind_set_channel(h, pin, state == ON))
 		{
-			printf("Fail to write mosfet\n");
-			return (FAIL);
+			printf("Fail to write mosfet (%s)\n",
+				mosind_strerror(mosind_last_error()));
+			ret = FAIL;
 		}
 	}
 	else
@@ -599,32 +351,19 @@ static int doMosfetWrite(int argc, char *argv[])
 		if (val < 0 || val > 255)
 		{
 			printf("Invalid mosfet value\n");
+			mosind_close(h);
 			return (FAIL);
 		}
 
-		retry = RETRY_TIMES;
-		valR = -1;
-		while ( (retry > 0) && (valR != val))
-		{
-
-			if (OK != mosfetSet(dev, val))
-			{
-				printf("Fail to write mosfet!\n");
-				return (FAIL);
-			}
-			if (OK != mosfetGet(dev, &valR))
-			{
-				printf("Fail to read mosfet!\n");
-				return (FAIL);
-			}
-		}
-		if (retry == 0)
+		if (OK != mosind_set_mask(h, (uint8_t)val))
 		{
-			printf("Fail to write mosfet!\n");
-			return (FAIL);
+			printf("Fail to write mosfet (%s)!\n",
+				mosind_strerror(mosind_last_error()));
+			ret = FAIL;
 		}
 	}
-	return OK;
+	mosind_close(h);
+	return ret;
 }
 
 
@@ -636,63 +375,55 @@ static int doMosfetWrite(int argc, char *argv[])
 static int doMosfetPWMWrite(int argc, char *argv[])
 {
 	int pin = 0;
-	int dev = 0;
-	int retry = 0;
-
-	float pwm = 0;
-	float pwmR = 101;
+	int i = 0;
+	int ret = OK;
+	mosind_t *h = NULL;
+	u16 perMille[MOSFET_NO];
 
-	if (argc != 5)
+	if ( (argc != 5) && (argc != 4 + MOSFET_NO))
 	{
 		printf("Usage: 8mosind <id> pwmwr <mosfet number> <0..100> \n");
+		printf("Usage: 8mosind <id> pwmwr all <ch1> .. <ch8> \n");
 		return (FAIL);
 	}
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	h = mosind_open(atoi(argv[1]));
+	if (NULL == h)
 	{
 		return (FAIL);
 	}
-	if (argc == 5)
+	if (argc == 4 + MOSFET_NO)
 	{
-		pin = atoi(argv[3]);
-		if ( (pin < CHANNEL_NR_MIN) || (pin > MOSFET_CH_NR_MAX))
+		if (strcasecmp(argv[3], "all") != 0)
 		{
-			printf("Mosfet number value out of range\n");
+			printf("Usage: 8mosind <id> pwmwr all <ch1> .. <ch8> \n");
+			mosind_close(h);
 			return (FAIL);
 		}
-
-		pwm = atof(argv[4]);
-
-		retry = RETRY_TIMES;
-
-		while ( (retry > 0) && (pwmR != pwm))
-		{
-			if (OK != mosfetChSetPwm(dev, pin, pwm))
-			{
-				printf("Fail to write mosfet or not PWM capable board\n");
-				return (FAIL);
-			}
-			if (OK != mosfetChGetPwm(dev, pin, &pwmR))
-			{
-				printf("Fail to read mosfet\n");
-				return (FAIL);
-			}
-			retry--;
-		}
-#ifdef DEBUG_I
-		if(retry < RETRY_TIMES)
+		for (i = 0; i < MOSFET_NO; i++)
 		{
-			printf("retry %d times\n", 3-retry);
+			perMille[i] = pwmPercentParse(argv[4 + i]);
 		}
-#endif
-		if (retry == 0)
+		ret = mosind_pwm_write_all(h, perMille);
+	}
+	else
+	{
+		pin = atoi(argv[3]);
+		if ( (pin < CHANNEL_NR_MIN) || (pin > MOSFET_CH_NR_MAX))
 		{
-			printf("Fail to write mosfet\n");
+			printf("Mosfet number value out of range\n");
+			mosind_close(h);
 			return (FAIL);
 		}
+		ret = mosind_pwm_write(h, pin, pwmPercentParse(argv[4]));
 	}
-	return OK;
+	if (OK != ret)
+	{
+		printf("Fail to write mosfet or not PWM capable board (%s)\n",
+			mosind_strerror(mosind_last_error()));
+	}
+	mosind_close(h);
+	return ret == OK ? OK : FAIL;
 }
 
 /*
@@ -703,12 +434,13 @@ static int doMosfetPWMWrite(int argc, char *argv[])
 static int doMosfetRead(int argc, char *argv[])
 {
 	int pin = 0;
-	int val = 0;
-	int dev = 0;
-	OutStateEnumType state = STATE_COUNT;
+	int on = 0;
+	int ret = OK;
+	uint8_t val = 0;
+	mosind_t *h = NULL;
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	h = mosind_open(atoi(argv[1]));
+	if (NULL == h)
 	{
 		return (FAIL);
 	}
@@ -719,38 +451,37 @@ static int doMosfetRead(int argc, char *argv[])
 		if ( (pin < CHANNEL_NR_MIN) || (pin > MOSFET_CH_NR_MAX))
 		{
 			printf("Mosfet number value out of range!\n");
-			return (FAIL);
+			ret = FAIL;
 		}
-
-		if (OK != mosfetChGet(dev, pin, &state))
+		else if (OK != mosind_get_channel(h, pin, &on))
 		{
 			printf("Fail to read!\n");
-			return (FAIL);
-		}
-		if (state != 0)
-		{
-			printf("1\n");
+			ret = FAIL;
 		}
 		else
 		{
-			printf("0\n");
+			printf("%d\n", on ? 1 : 0);
 		}
 	}
 	else if (argc == 3)
 	{
-		if (OK != mosfetGet(dev, &val))
+		if (OK != mosind_get_mask(h, &val))
 		{
 			printf("Fail to read!\n");
-			return (FAIL);
+			ret = FAIL;
+		}
+		else
+		{
+			printf("%d\n", val);
 		}
-		printf("%d\n", val);
 	}
 	else
 	{
 		printf("Usage: %s read mosfet value\n", argv[0]);
-		return (FAIL);
+		ret = FAIL;
 	}
-	return OK;
+	mosind_close(h);
+	return ret;
 }
 
 
@@ -763,48 +494,65 @@ static int doMosfetRead(int argc, char *argv[])
 static int doMosfetPWMRead(int argc, char *argv[])
 {
 	int pin = 0;
-	float val = 0;
-	int dev = 0;
-
+	int val = 0;
+	int i = 0;
+	int ret = OK;
+	mosind_t *h = NULL;
+	u16 perMille[MOSFET_NO];
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	h = mosind_open(atoi(argv[1]));
+	if (NULL == h)
 	{
 		return (FAIL);
 	}
 
-	if (argc == 4)
+	if ( (argc == 4) && (strcasecmp(argv[3], "all") == 0))
+	{
+		if (OK != mosind_pwm_read_all(h, perMille))
+		{
+			printf("Fail to read!\n");
+			ret = FAIL;
+		}
+		for (i = 0; (ret == OK) && (i < MOSFET_NO); i++)
+		{
+			printf("%.01f%c", (float)perMille[i] / 10, i < MOSFET_NO - 1 ? ' ' : '\n');
+		}
+	}
+	else if (argc == 4)
 	{
 		pin = atoi(argv[3]);
 		if ( (pin < CHANNEL_NR_MIN) || (pin > MOSFET_CH_NR_MAX))
 		{
 			printf("Mosfet number value out of range!\n");
-			return (FAIL);
+			ret = FAIL;
 		}
-
-		if (OK != mosfetChGetPwm(dev, pin, &val))
+		else if (OK != mosind_pwm_read(h, pin, &val))
 		{
 			printf("Fail to read!\n");
-			return (FAIL);
+			ret = FAIL;
+		}
+		else
+		{
+			printf("%.01f\n", (float)val / 10);
 		}
-
-			printf("%.01f\n", val);
 	}
 	else
 	{
 		printf("Usage: %s read mosfet value\n", argv[0]);
-		return (FAIL);
+		ret = FAIL;
 	}
-	return OK;
+	mosind_close(h);
+	return ret;
 }
 
 static int doMosfetFreqWr(int argc, char *argv[])
 {
 	int freq = 0;
-	int dev = 0;
+	int ret = OK;
+	mosind_t *h = NULL;
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	h = mosind_open(atoi(argv[1]));
+	if (NULL == h)
 	{
 		return (FAIL);
 	}
@@ -812,48 +560,58 @@ static int doMosfetFreqWr(int argc, char *argv[])
 	if (argc == 4)
 	{
 		freq = atoi(argv[3]);
-
-		if (OK != mosfetSetFrequency(dev, freq))
+		if ( (freq < MOS_MIN_FREQ) || (freq > MOS_MAX_FREQ))
+		{
+			printf("Frequency out of range [%d..%d]\n", MOS_MIN_FREQ, MOS_MAX_FREQ);
+			ret = FAIL;
+		}
+		else if (OK != mosind_freq_write(h, freq))
 		{
 			printf("Fail to set the frequency!");
-			return FAIL;
+			ret = FAIL;
 		}
 	}
 	else
 	{
 		printf("Usage: %s set pwm frequency\n", argv[0]);
-		return (FAIL);
+		ret = FAIL;
 	}
-	return OK;
+	mosind_close(h);
+	return ret;
 }
 
 
 static int doMosfetFreqRd(int argc, char *argv[])
 {
 	int freq = 0;
-	int dev = 0;
+	int ret = OK;
+	mosind_t *h = NULL;
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	h = mosind_open(atoi(argv[1]));
+	if (NULL == h)
 	{
 		return (FAIL);
 	}
 
 	if (argc == 3)
 	{
-		if (OK != mosfetGetFrequency(dev, &freq))
+		if (OK != mosind_freq_read(h, &freq))
 		{
 			printf("Fail to read the frequency!");
-			return FAIL;
+			ret = FAIL;
+		}
+		else
+		{
+			printf("%d\n", freq);
 		}
-		printf("%d\n", freq);
 	}
 	else
 	{
 		printf("Usage: %s get pwm frequency\n", argv[0]);
-		return (FAIL);
+		ret = FAIL;
 	}
-	return OK;
+	mosind_close(h);
+	return ret;
 }
 
 static int doHelp(int argc, char *argv[])
@@ -899,59 +657,490 @@ static int doVersion(int argc, char *argv[])
 
 static int doList(int argc, char *argv[])
 {
-	int ids[8];
+	MosfetScanType found[STACK_LEVELS];
 	int i;
 	int cnt = 0;
 
-	UNUSED(argc);
-	UNUSED(argv);
-
-	for (i = 0; i < 8; i++)
+	if (argc == 3)
+	{
+		if (OK != mosfetScanConfig(argv[2]))
+		{
+			printf("Invalid address order \"%s\" (pa, ap, p, a)\n", argv[2]);
+			return ERROR;
+		}
+	}
+	else if (argc != 2)
+	{
+		printf("%s", CMD_LIST.usage1);
+		return ARG_CNT_ERR;
+	}
+	cnt = mosfetScan(found);
+	if (cnt < 0)
+	{
+		return ERROR;
+	}
+	printf("%d board(s) detected\n", cnt);
+	if (cnt > 0)
+	{
+		printf("Id:");
+	}
+	for (i = cnt - 1; i >= 0; i--)
 	{
-		if (boardCheck(MOSFET8_HW_I2C_BASE_ADD + i) == OK)
+		printf(" %d", found[i].stack);
+	}
+	printf("\n");
+	for (i = 0; i < cnt; i++)
+	{
+		printf("Stack %d: 0x%02x %s", found[i].stack, found[i].hwAdd,
+			found[i].alternate ? "alternate" : "primary");
+		if (found[i].extended)
 		{
-			ids[cnt] = i;
-			cnt++;
+			printf(", hw %d.%d, fw %d.%d\n", found[i].hwMajor, found[i].hwMinor,
+				found[i].fwMajor, found[i].fwMinor);
 		}
 		else
 		{
-			if (boardCheck(MOSFET8_HW_I2C_ALTERNATE_BASE_ADD + i) == OK)
+			printf(", I/O expander\n");
+		}
+	}
+	return OK;
+}
+
+/*
+ * playOutput:
+ *	Put one pattern record on its board, initialized before the play starts
+ */
+static int playOutput(const PatternRecordType *rec)
+{
+	int dev = doBoardInit(rec->stack & 0x07); // known, no transaction
+
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	switch (rec->type)
+	{
+	case PATTERN_REC_MASK:
+		return mosfetSet(dev, rec->mask);
+	case PATTERN_REC_PWM:
+		if (rec->channel == 0)
+		{
+			return mosfetPwmSetAll(dev, rec->pwm);
+		}
+		if (rec->channel > MOSFET_CH_NR_MAX)
+		{
+			return ERROR;
+		}
+		// +0.5 so the per mille value survives the float round trip
+		return mosfetChSetPwm(dev, rec->channel,
+			(rec->pwm[rec->channel - 1] + 0.5f) / 10);
+	default:
+		return ERROR;
+	}
+}
+
+static int doPlay(int argc, char *argv[])
+{
+	PatternType pat;
+	PatternStatsType stats;
+	int repeat = 1;
+	int ret;
+	int i;
+
+	if ( (argc != 3) && (argc != 4))
+	{
+		printf("%s", CMD_PLAY.usage1);
+		return ERROR;
+	}
+	if (argc == 4)
+	{
+		repeat = atoi(argv[3]);
+		if (repeat < 0)
+		{
+			printf("Invalid repeat count\n");
+			return ERROR;
+		}
+	}
+	if (OK != patternOpen(argv[2], &pat))
+	{
+		return ERROR;
+	}
+	for (i = 0; i < STACK_LEVELS; i++)
+	{
+		if ( (pat.hdr->boards & (1 << i)) && (doBoardInit(i) <= 0))
+		{
+			patternClose(&pat);
+			return ERROR;
+		}
+	}
+	ret = patternPlay(&pat, repeat, &playOutput, &stats);
+	patternReport(&stats);
+	patternClose(&pat);
+	return ret;
+}
+
+/*
+ * telemetrySample:
+ *	One burst read of a board initialized before the sampling starts
+ */
+static int telemetrySample(int stack, TelemetryRecordType *rec)
+{
+	MosfetDiagType diag;
+	int dev = doBoardInit(stack); // known, no transaction
+
+	if ( (dev <= 0) || (OK != mosfetDiagRead(dev, &diag)))
+	{
+		return ERROR;
+	}
+	rec->flags = diag.extended ? TELEMETRY_FLAG_EXTENDED : 0;
+	rec->mosfets = diag.mosfets;
+	rec->diag3v3mV = diag.diag3v3mV;
+	rec->temperature = diag.temperature;
+	return OK;
+}
+
+static int doTelemetry(int argc, char *argv[])
+{
+	MosfetScanType found[STACK_LEVELS];
+	TelemetryConfigType cfg;
+	TelemetryStatsType stats;
+	char *p = NULL;
+	char *end = NULL;
+	long val;
+	double seconds = 0;
+	int cnt;
+	int ret;
+	int i;
+
+	if ( (argc < 4) || (argc > 7))
+	{
+		printf("%s", CMD_TELEMETRY.usage1);
+		return ERROR;
+	}
+	memset(&cfg, 0, sizeof(cfg));
+	if (strcasecmp(argv[2], "all") == 0)
+	{
+		cnt = mosfetScan(found);
+		for (i = 0; i < cnt; i++)
+		{
+			cfg.boards |= 1 << found[i].stack;
+		}
+	}
+	else
+	{
+		for (p = argv[2]; ; p = end + 1)
+		{
+			val = strtol(p, &end, 10);
+			if ( (end == p) || (val < 0) || (val >= STACK_LEVELS)
+				|| ( (*end != 0) && (*end != ',')))
 			{
-				ids[cnt] = i;
-				cnt++;
+				printf("Invalid board list \"%s\"\n", argv[2]);
+				return ERROR;
+			}
+			cfg.boards |= 1 << val;
+			if (*end == 0)
+			{
+				break;
 			}
 		}
 	}
-	printf("%d board(s) detected\n", cnt);
-	if (cnt > 0)
+	if (cfg.boards == 0)
 	{
-		printf("Id:");
+		printf("No board detected\n");
+		return ERROR;
+	}
+	val = atol(argv[3]);
+	if ( (val < 1) || (val > TELEMETRY_RATE_MAX))
+	{
+		printf("Invalid rate [1..%d]\n", TELEMETRY_RATE_MAX);
+		return ERROR;
+	}
+	cfg.periodUs = (uint32_t)(1000000 / val);
+	if (argc > 4)
+	{
+		seconds = strtod(argv[4], &end);
+		if ( (end == argv[4]) || (*end != 0) || (seconds < 0))
+		{
+			printf("Invalid duration \"%s\"\n", argv[4]);
+			return ERROR;
+		}
+	}
+	cfg.durationUs = (long long)(seconds * 1e6);
+	cfg.path = argc > 5 ? argv[5] : "-";
+	if (argc > 6)
+	{
+		if (strcasecmp(argv[6], "bin") == 0)
+		{
+			cfg.binary = 1;
+		}
+		else if (strcasecmp(argv[6], "csv") != 0)
+		{
+			printf("Invalid format \"%s\" (csv, bin)\n", argv[6]);
+			return ERROR;
+		}
+	}
+	for (i = 0; i < STACK_LEVELS; i++)
+	{
+		if ( (cfg.boards & (1 << i)) && (doBoardInit(i) <= 0))
+		{
+			return ERROR;
+		}
+	}
+	ret = telemetryRun(&cfg, &telemetrySample, &stats);
+	// the samples may be on stdout, keep the summary out of them
+	telemetryReport(&stats, strcmp(cfg.path, "-") == 0 ? stderr : stdout);
+	return ret;
+}
+
+static int doCompile(int argc, char *argv[])
+{
+	if (argc != 4)
+	{
+		printf("%s", CMD_COMPILE.usage1);
+		return ERROR;
+	}
+	return patternCompile(argv[2], argv[3]);
+}
+
+/*
+ * doSync:
+ *	Parse "<id>:<value>[:<pwm1>,..,<pwm8>]" arguments, one for each board
+ */
+static int doSync(int argc, char *argv[])
+{
+	MosfetFrameType frames[STACK_LEVELS];
+	MosfetSyncStatType stat;
+	char *p = NULL;
+	char *end = NULL;
+	long val;
+	int count = argc - 2;
+	int i;
+	int j;
+
+	if ( (count < 1) || (count > STACK_LEVELS))
+	{
+		printf("%s", CMD_SYNC.usage1);
+		return ERROR;
+	}
+	memset(frames, 0, sizeof(frames));
+	for (i = 0; i < count; i++)
+	{
+		p = argv[i + 2];
+		val = strtol(p, &end, 10);
+		if ( (end == p) || (*end != ':') || (val < 0) || (val >= STACK_LEVELS))
+		{
+			printf("Invalid board \"%s\"\n", argv[i + 2]);
+			return ERROR;
+		}
+		frames[i].stack = (u8)val;
+		p = end + 1;
+		val = strtol(p, &end, 0);
+		if ( (end == p) || ( (*end != 0) && (*end != ':')) || (val < 0) || (val > 255))
+		{
+			printf("Invalid value \"%s\"\n", argv[i + 2]);
+			return ERROR;
+		}
+		frames[i].mosfets = (u8)val;
+		if (*end == 0)
+		{
+			continue;
+		}
+		frames[i].pwmValid = 1;
+		for (j = 0, p = end + 1; j < MOSFET_NO; j++, p = end + 1)
+		{
+			val = (long)(strtod(p, &end) * 10 + 0.5);
+			if ( (end == p) || (val < 0) || (val > PWM_MAX_PERMILLE)
+				|| (*end != (j == MOSFET_NO - 1 ? 0 : ',')))
+			{
+				printf("Invalid pwm list \"%s\"\n", argv[i + 2]);
+				return ERROR;
+			}
+			frames[i].pwm[j] = (u16)val;
+		}
+	}
+	if (OK != mosfetSync(frames, count, &stat))
+	{
+		return ERROR;
 	}
-	while (cnt > 0)
+	printf("%d board(s) updated, skew <= %.1f us (%s)", count,
+		stat.spanNs / 1e3, stat.transfers == 1 ? "one I2C_RDWR transfer" :
+		"back to back writes");
+	if (stat.pwmSpanNs > 0)
 	{
-		cnt--;
-		printf(" %d", ids[cnt]);
+		printf(", pwm %.1f us", stat.pwmSpanNs / 1e3);
 	}
 	printf("\n");
 	return OK;
 }
 
+static int doMask(int argc, char *argv[])
+{
+	MosfetSyncStatType stat;
+	uint64_t mask = 0;
+	uint64_t one = 0;
+	uint64_t state = 0;
+	char list[CHMAP_CHANNELS * 4];
+	const char *name = NULL;
+	int i;
+
+	if ( (argc == 3) && (strcasecmp(argv[2], "groups") == 0))
+	{
+		for (i = 0; NULL != (name = chmapGroupName(i, &one)); i++)
+		{
+			chmapFormat(one, list, sizeof(list));
+			printf("%s %s\n", name, list);
+		}
+		return OK;
+	}
+	if (argc < 4)
+	{
+		printf("%s", CMD_MASK.usage1);
+		return ERROR;
+	}
+	for (i = 3; i < argc; i++)
+	{
+		if (OK != chmapParse(argv[i], &one))
+		{
+			printf("Invalid channels \"%s\"\n", argv[i]);
+			return ERROR;
+		}
+		mask |= one;
+	}
+	if (strcasecmp(argv[2], "set") == 0)
+	{
+		return mosfetMaskApply(mask, 0, 0, &stat);
+	}
+	if (strcasecmp(argv[2], "clr") == 0)
+	{
+		return mosfetMaskApply(0, mask, 0, &stat);
+	}
+	if (strcasecmp(argv[2], "toggle") == 0)
+	{
+		return mosfetMaskApply(0, 0, mask, &stat);
+	}
+	if (strcasecmp(argv[2], "read") == 0)
+	{
+		if (OK != mosfetMaskGet(mask, &state))
+		{
+			printf("Fail to read!\n");
+			return ERROR;
+		}
+		chmapFormat(state, list, sizeof(list));
+		printf("0x%016llx %s\n", (unsigned long long)state, list);
+		return OK;
+	}
+	printf("%s", CMD_MASK.usage1);
+	return ERROR;
+}
+
+static int cmpLongLong(const void *a, const void *b)
+{
+	long long x = *(const long long*)a;
+	long long y = *(const long long*)b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// nearest rank percentile of the sorted samples, in microseconds
+static double percentileUs(const long long *ns, long n, double p)
+{
+	long idx = (long)ceil(p * n / 100.0) - 1;
+
+	if (idx < 0)
+	{
+		idx = 0;
+	}
+	return ns[idx >= n ? n - 1 : idx] / 1e3;
+}
+
+/*
+ * doLatency:
+ *	Time back to back OUTPORT read + write of the same value cycles, the
+ *	samples buffer is allocated and touched before the first cycle
+ */
+static int doLatency(int argc, char *argv[])
+{
+	struct timespec t0;
+	struct timespec t1;
+	long long *ns = NULL;
+	long cycles = LATENCY_CYCLES;
+	long i;
+	double sum = 0;
+	char rt[160];
+	int dev = 0;
+	u8 io = 0;
+
+	if ( (argc != 3) && (argc != 4))
+	{
+		printf("%s", CMD_LATENCY.usage1);
+		return ERROR;
+	}
+	if (argc == 4)
+	{
+		cycles = atol(argv[3]);
+		if ( (cycles < 1) || (cycles > LATENCY_CYCLES_MAX))
+		{
+			printf("Invalid cycles number [1..%d]\n", LATENCY_CYCLES_MAX);
+			return ERROR;
+		}
+	}
+	dev = doBoardInit(atoi(argv[1]));
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	ns = malloc(cycles * sizeof(long long));
+	if (NULL == ns)
+	{
+		printf("Fail to allocate the samples buffer\n");
+		return ERROR;
+	}
+	memset(ns, 0, cycles * sizeof(long long));
+	if (OK != outportRead(dev, &io, 0)) // warm up the bus path
+	{
+		printf("Fail to read!\n");
+		free(ns);
+		return ERROR;
+	}
+	for (i = 0; i < cycles; i++)
+	{
+		deadlineNow(&t0);
+		if ( (OK != outportRead(dev, &io, 0)) || (OK != outportWrite(dev, io)))
+		{
+			printf("Fail at cycle %ld\n", i);
+			free(ns);
+			return ERROR;
+		}
+		deadlineNow(&t1);
+		ns[i] = (long long)(t1.tv_sec - t0.tv_sec) * 1000000000LL
+			+ (t1.tv_nsec - t0.tv_nsec);
+		sum += ns[i];
+	}
+	qsort(ns, cycles, sizeof(long long), &cmpLongLong);
+	rtDescribe(rt, sizeof(rt));
+	printf("%ld read/write cycles, %s%s\n", cycles, rt,
+		gRt.lockMemory ? ", memory locked" : "");
+	printf("Latency (us): min %.1f, avg %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+		ns[0] / 1e3, sum / cycles / 1e3, percentileUs(ns, cycles, 99),
+		percentileUs(ns, cycles, 99.9), ns[cycles - 1] / 1e3);
+	free(ns);
+	return OK;
+}
+
 /* 
  * Self test for production
  */
 static int doTest(int argc, char *argv[])
 {
-	int dev = 0;
 	int i = 0;
-	int retry = 0;
-	int relVal;
-	int valR;
 	int mosfetResult = 0;
+	mosind_t *h = NULL;
 	FILE *file = NULL;
+	struct timespec next;
 	const u8 mosfetOrder[8] = {1, 2, 3, 4, 5, 6, 7, 8};
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	h = mosind_open(atoi(argv[1]));
+	if (NULL == h)
 	{
 		return (FAIL);
 	}
@@ -967,10 +1156,10 @@ static int doTest(int argc, char *argv[])
 //mosfet test****************************
 	if (strcasecmp(argv[2], "test") == 0)
 	{
-		relVal = 0;
 		printf(
 			"Are all mosfets and LEDs turning on and off in sequence?\nPress y for Yes or any key for No....");
 		startThread();
+		deadlineNow(&next);
 		while (mosfetResult == 0)
 		{
 			for (i = 0; i < 8; i++)
@@ -980,31 +1169,16 @@ static int doTest(int argc, char *argv[])
 				{
 					break;
 				}
-				valR = 0;
-				relVal = (u8)1 << (mosfetOrder[i] - 1);
-
-				retry = RETRY_TIMES;
-				while ( (retry > 0) && ( (valR & relVal) == 0))
-				{
-					if (OK != mosfetChSet(dev, mosfetOrder[i], ON))
-					{
-						retry = 0;
-						break;
-					}
-
-					if (OK != mosfetGet(dev, &valR))
-					{
-						retry = 0;
-					}
-				}
-				if (retry == 0)
+				if (OK != mosind_set_channel(h, mosfetOrder[i], 1))
 				{
 					printf("Fail to write mosfet\n");
 					if (file)
 						fclose(file);
+					mosind_close(h);
 					return (FAIL);
 				}
-				busyWait(150);
+				deadlineAdd(&next, TEST_STEP_US);
+				waitUntil(&next);
 			}
 
 			for (i = 0; i < 8; i++)
@@ -1014,28 +1188,16 @@ static int doTest(int argc, char *argv[])
 				{
 					break;
 				}
-				valR = 0xff;
-				relVal = (u8)1 << (mosfetOrder[i] - 1);
-				retry = RETRY_TIMES;
-				while ( (retry > 0) && ( (valR & relVal) != 0))
-				{
-					if (OK != mosfetChSet(dev, mosfetOrder[i], OFF))
-					{
-						retry = 0;
-					}
-					if (OK != mosfetGet(dev, &valR))
-					{
-						retry = 0;
-					}
-				}
-				if (retry == 0)
+				if (OK != mosind_set_channel(h, mosfetOrder[i], 0))
 				{
 					printf("Fail to write mosfet!\n");
 					if (file)
 						fclose(file);
+					mosind_close(h);
 					return (FAIL);
 				}
-				busyWait(150);
+				deadlineAdd(&next, TEST_STEP_US);
+				waitUntil(&next);
 			}
 		}
 	}
@@ -1065,7 +1227,56 @@ static int doTest(int argc, char *argv[])
 	{
 		fclose(file);
 	}
-	mosfetSet(dev, 0);
+	mosind_set_mask(h, 0);
+	mosind_close(h);
+	return OK;
+}
+
+/*
+ * doDump:
+ *	Display the board register image
+ ******************************************************************************************
+ */
+static int doDump(int argc, char *argv[])
+{
+	int dev = 0;
+	int i = 0;
+	MosfetImageType img;
+
+	if (argc != 3)
+	{
+		printf("Usage: 8mosind <id> dump\n");
+		return (FAIL);
+	}
+	dev = doBoardInit(atoi(argv[1]));
+	if (dev <= 0)
+	{
+		return (FAIL);
+	}
+	if (OK != mosfetImageRead(dev, &img))
+	{
+		printf("Fail to read!\n");
+		return (FAIL);
+	}
+	printf("mosfets: %d\n", img.mosfets);
+	printf("expander: in 0x%02x out 0x%02x polinv 0x%02x cfg 0x%02x\n",
+		img.inport, img.outport, img.polinv, img.cfg);
+	if (!img.extended)
+	{
+		return OK;
+	}
+	printf("pwm:");
+	for (i = 0; i < MOSFET_NO; i++)
+	{
+		printf(" %.01f", (float)img.pwm[i] / 10);
+	}
+	printf("\n");
+	printf("frequency: %d\n", img.pwmFreq);
+	printf("3v3: %d mV\n", img.diag3v3mV);
+	printf("temperature: %d C\n", img.temperature);
+	printf("<mode> <baudrate> <stopbits> <parity> <add> %d %d %d %d %d\n",
+		(int)img.modbus.mbType, (int)img.modbus.mbBaud, (int)img.modbus.mbStopB,
+		(int)img.modbus.mbParity, (int)img.modbus.add);
 	return OK;
 }
 
@@ -1077,60 +1288,71 @@ static int doWarranty(int argc UNU, char* argv[] UNU)
 
 int doRs485Read(int argc, char *argv[])
 {
-	int dev = 0;
+	mosind_rs485_t cfg;
+	int ret = OK;
+	mosind_t *h = NULL;
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	h = mosind_open(atoi(argv[1]));
+	if (NULL == h)
 	{
 		return ERROR;
 	}
 
 	if (argc == 3)
 	{
-		if (OK != cfg485Get(dev))
+		if (OK != mosind_rs485_read(h, &cfg))
 		{
-			return ERROR;
+			ret = ERROR;
+		}
+		else
+		{
+			printf("<mode> <baudrate> <stopbits> <parity> <add> %d %d %d %d %d\n",
+				cfg.mode, cfg.baud, cfg.stopBits, cfg.parity, cfg.address);
 		}
 	}
 	else
 	{
-		return ARG_CNT_ERR;
+		ret = ARG_CNT_ERR;
 	}
-	return OK;
+	mosind_close(h);
+	return ret;
 }
 
 int doRs485Write(int argc, char *argv[])
 {
-	int dev = 0;
-	u8 mode = 0;
-	u32 baud = 1200;
-	u8 stopB = 1;
-	u8 parity = 0;
-	u8 add = 0;
+	mosind_rs485_t cfg;
+	int ret = OK;
+	mosind_t *h = NULL;
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	h = mosind_open(atoi(argv[1]));
+	if (NULL == h)
 	{
 		return ERROR;
 	}
 	if (argc == 8)
 	{
-		mode = 0xff & atoi(argv[3]);
-		baud = atoi(argv[4]);
-		stopB = 0xff & atoi(argv[5]);
-		parity = 0xff & atoi(argv[6]);
-		add = 0xff & atoi(argv[7]);
-		if (OK != cfg485Set(dev, mode, baud, stopB, parity, add))
+		cfg.mode = atoi(argv[3]);
+		cfg.baud = atoi(argv[4]);
+		cfg.stopBits = atoi(argv[5]);
+		cfg.parity = atoi(argv[6]);
+		cfg.address = atoi(argv[7]);
+		if (OK != mosind_rs485_write(h, &cfg))
 		{
-			return ERROR;
+			printf("Fail to write RS485 settings (%s)!\n",
+				mosind_strerror(mosind_last_error()));
+			ret = ERROR;
+		}
+		else
+		{
+			printf("done\n");
 		}
-		printf("done\n");
 	}
 	else
 	{
-		return ARG_CNT_ERR;
+		ret = ARG_CNT_ERR;
 	}
-	return OK;
+	mosind_close(h);
+	return ret;
 }
 
 
@@ -1146,6 +1368,20 @@ static void cliInit(void)
 	i++;
 	memcpy(&gCmdArray[i], &CMD_LIST, sizeof(CliCmdType));
 	i++;
+	memcpy(&gCmdArray[i], &CMD_BATCH, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_DAEMON, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_PLAY, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_COMPILE, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_TELEMETRY, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_SYNC, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_MASK, sizeof(CliCmdType));
+	i++;
 	memcpy(&gCmdArray[i], &CMD_WRITE, sizeof(CliCmdType));
 	i++;
 	memcpy(&gCmdArray[i], &CMD_READ, sizeof(CliCmdType));
@@ -1160,6 +1396,10 @@ static void cliInit(void)
 	i++;
 	memcpy(&gCmdArray[i], &CMD_TEST, sizeof(CliCmdType));
 	i++;
+	memcpy(&gCmdArray[i], &CMD_DUMP, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_LATENCY, sizeof(CliCmdType));
+	i++;
 	memcpy(&gCmdArray[i], &CMD_VERSION, sizeof(CliCmdType));
 	i++;
 	memcpy(&gCmdArray[i], &CMD_RS485_WRITE, sizeof(CliCmdType));
@@ -1168,6 +1408,7 @@ static void cliInit(void)
 
 }
 
+#ifdef LEGACY_SEM
 int waitForI2C(sem_t *sem)
 {
   int semVal = 2;
@@ -1217,40 +1458,305 @@ int releaseI2C(sem_t *sem)
 #endif
 return 0;
 }
+#endif
 
-int main(int argc, char *argv[])
+static int envInt(const char *name, int def)
+{
+	char *val = secure_getenv(name);
+
+	if (NULL == val)
+	{
+		return def;
+	}
+	return atoi(val);
+}
+
+/*
+ * envInit:
+ *	Load the library settings and the real-time settings from the environment
+ */
+static int envInit(void)
+{
+	if (OK != mosind_init())
+	{
+		return ERROR;
+	}
+	// not for the setuid binary run by another user: the real-time settings
+	// are for root or for a user already allowed to use them
+	gRt.priority = envInt("MOSIND_RT_PRIO", 0);
+	gRt.lockMemory = envInt("MOSIND_RT_LOCK", 0);
+	if ( (NULL != secure_getenv("MOSIND_RT_CPUS"))
+		&& (0 != rtCpuParse(secure_getenv("MOSIND_RT_CPUS"), &gRt.cpuMask)))
+	{
+		printf("Invalid MOSIND_RT_CPUS \"%s\" (e.g. 3 or 2,3 or 0-1)\n",
+			secure_getenv("MOSIND_RT_CPUS"));
+		return ERROR;
+	}
+	return OK;
+}
+
+/*
+ * cliFind:
+ *	Return the command table entry for a command line, NULL if there is none
+ */
+static const CliCmdType* cliFind(int argc, char *argv[])
 {
 	int i = 0;
+
+	for (i = 0; i < CMD_ARRAY_SIZE; i++)
+	{
+		if ( (gCmdArray[i].name != NULL) && (gCmdArray[i].namePos < argc))
+		{
+			if (strcasecmp(argv[gCmdArray[i].namePos], gCmdArray[i].name) == 0)
+			{
+				return &gCmdArray[i];
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * cliRunLine:
+ *	Split one text line in arguments and execute it. Only the commands that
+ *	just talk to the boards and end quickly are accepted: a line may come from
+ *	any client of the root daemon, it must not name files or block the others.
+ *	Return CLI_EMPTY for blank or comment lines
+ */
+#define CLI_LINE_SIZE	1024
+#define CLI_ARGS_MAX	32
+#define CLI_EMPTY		1
+
+static const CliCmdType *const gLineCmd[] =
+{
+	&CMD_HELP, &CMD_VERSION, &CMD_WAR, &CMD_LIST, &CMD_SYNC, &CMD_MASK,
+	&CMD_WRITE, &CMD_READ, &CMD_PWM_WRITE, &CMD_PWM_READ, &CMD_F_WRITE,
+	&CMD_F_READ, &CMD_DUMP, &CMD_RS485_WRITE, &CMD_RS485_READ, NULL};
+
+static int cliLineAllowed(const CliCmdType *cmd)
+{
+	int i;
+
+	for (i = 0; NULL != gLineCmd[i]; i++)
+	{
+		if (cmd->pFunc == gLineCmd[i]->pFunc)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int cliRunLine(char *line)
+{
+	char *args[CLI_ARGS_MAX];
+	char *tok = NULL;
+	char *save = NULL;
+	const CliCmdType *cmd = NULL;
+	int n = 0;
 	int ret = 0;
 
+	tok = strchr(line, '#');
+	if (NULL != tok)
+	{
+		*tok = 0;
+	}
+	args[n++] = "8mosind";
+	for (tok = strtok_r(line, " \t\r\n", &save); (NULL != tok) && (n < CLI_ARGS_MAX);
+		tok = strtok_r(NULL, " \t\r\n", &save))
+	{
+		args[n++] = tok;
+	}
+	if (n == 1)
+	{
+		return CLI_EMPTY;
+	}
+	cmd = cliFind(n, args);
+	if (NULL == cmd)
+	{
+		printf("Invalid command option\n");
+		ret = FAIL;
+	}
+	else if (!cliLineAllowed(cmd))
+	{
+		printf("Command \"%s\" not available here\n", cmd->name);
+		ret = FAIL;
+	}
+	else
+	{
+		ret = cmd->pFunc(n, args);
+	}
+	if (ret != OK)
+	{
+		// re-probe the boards after any error, forget them after a bus error
+		doBoardRelease(i2cLastError() != I2C_ERR_NONE);
+		ret = FAIL;
+	}
+	inventoryFlush();
+	return ret;
+}
+
+/*
+ * doBatch:
+ *	Run many commands in one process, the boards are probed once and their
+ *	handles kept open until the end of the batch. With MOSIND_VERIFY=end the
+ *	writes of all the lines are read back in one pass at the end
+ ******************************************************************************************
+ */
+static int doBatch(int argc, char *argv[])
+{
+	FILE *in = stdin;
+	char line[CLI_LINE_SIZE];
+	int lineNr = 0;
+	int ret = 0;
+	int failed = 0;
+
+	if (argc > 3)
+	{
+		printf("Usage: 8mosind -batch [<file>]\n");
+		return (FAIL);
+	}
+	if ( (argc == 3) && (strcmp(argv[2], "-") != 0))
+	{
+		in = fopen(argv[2], "r");
+		if (NULL == in)
+		{
+			printf("Fail to open %s\n", argv[2]);
+			return (FAIL);
+		}
+	}
+	retryDeferBegin();
+	while (NULL != fgets(line, CLI_LINE_SIZE, in))
+	{
+		lineNr++;
+		ret = cliRunLine(line);
+		if (ret == CLI_EMPTY)
+		{
+			continue;
+		}
+		if (ret != OK)
+		{
+			failed++;
+		}
+		printf("%d: %s\n", lineNr, ret == OK ? "ok" : "fail");
+		fflush(stdout);
+	}
+	if (in != stdin)
+	{
+		fclose(in);
+	}
+	if (OK != retryDeferEnd())
+	{
+		printf("Fail to verify the writes: %s\n", retryErrName(retryLastError()));
+		failed++;
+	}
+	return failed == 0 ? OK : FAIL;
+}
+
+#ifdef LEGACY_SEM
+static sem_t *gSemaphore = NULL;
+#endif
+
+/*
+ * daemonRequest:
+ *	Execute one request received by the daemon, the bus is locked only by
+ *	the transactions themselves (and the legacy semaphore, if enabled, only
+ *	for the duration of the request)
+ */
+static int daemonRequest(char *line)
+{
+	int ret = 0;
+
+#ifdef LEGACY_SEM
+	waitForI2C(gSemaphore);
+#endif
+	ret = cliRunLine(line);
+#ifdef LEGACY_SEM
+	releaseI2C(gSemaphore);
+#endif
+	return ret == CLI_EMPTY ? DAEMON_EMPTY : ret;
+}
+
+/*
+ * doDaemon:
+ *	Serve the command set on a Unix domain socket until SIGINT/SIGTERM
+ ******************************************************************************************
+ */
+static int doDaemon(int argc, char *argv[])
+{
+	const char *path = getenv("MOSIND_SOCKET");
+	int ret = 0;
+
+	if (argc > 3)
+	{
+		printf("Usage: 8mosind -daemon [<socket path>]\n");
+		return (FAIL);
+	}
+	if (getuid() != geteuid())
+	{
+		// it would create and unlink the socket path with the setuid rights
+		printf("The daemon must be started by root, not through the setuid binary\n");
+		return (FAIL);
+	}
+	if (argc == 3)
+	{
+		path = argv[2];
+	}
+	if (NULL == path)
+	{
+		path = DAEMON_SOCKET_PATH;
+	}
+#ifdef LEGACY_SEM
+	releaseI2C(gSemaphore); // taken again around every request
+#endif
+	ret = daemonRun(path, getenv("MOSIND_SOCKET_GROUP"), &daemonRequest);
+#ifdef LEGACY_SEM
+	waitForI2C(gSemaphore);
+#endif
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret = 0;
+	const CliCmdType *cmd = NULL;
+
 	cliInit();
 	if (argc == 1)
 	{
 		printf("%s\n", usage);
 		return 1;
 	}
-#ifdef THREAD_SAFE
-	sem_t *semaphore = sem_open("/SMI2C_SEM", O_CREAT, 0000666, 3);
-	waitForI2C(semaphore);
-#endif
-	for (i = 0; i < CMD_ARRAY_SIZE; i++)
+	if (OK != envInit())
 	{
-		if ( (gCmdArray[i].name != NULL) && (gCmdArray[i].namePos < argc))
+		return 1;
+	}
+	if ( (gRt.priority > 0) || (gRt.cpuMask != 0) || gRt.lockMemory)
+	{
+		if (0 != rtApply(&gRt))
 		{
-			if (strcasecmp(argv[gCmdArray[i].namePos], gCmdArray[i].name) == 0)
-			{
-				ret = gCmdArray[i].pFunc(argc, argv);
-#ifdef THREAD_SAFE
-			 releaseI2C(semaphore);
-#endif
-				return ret;
-			}
+			return 1;
 		}
 	}
+#ifdef LEGACY_SEM
+	gSemaphore = sem_open("/SMI2C_SEM", O_CREAT, 0000666, 3);
+	waitForI2C(gSemaphore);
+#endif
+	cmd = cliFind(argc, argv);
+	if (NULL != cmd)
+	{
+		ret = cmd->pFunc(argc, argv);
+		doBoardRelease( (ret != OK) && (i2cLastError() != I2C_ERR_NONE));
+		i2cCloseAll();
+#ifdef LEGACY_SEM
+		releaseI2C(gSemaphore);
+#endif
+		return ret;
+	}
 	printf("Invalid command option\n");
 	printf("%s\n", usage);
-#ifdef THREAD_SAFE
-  releaseI2C(semaphore);
+#ifdef LEGACY_SEM
+  releaseI2C(gSemaphore);
 #endif
 	return -1;
 }
@@ -10,6 +10,7 @@
 #define MOSFET8_CFG_REG_ADD		0x03
 #define PWM_SIZE_B 2
 #define MOSFET_NO 8
+#define PWM_MAX_PERMILLE 1000
 
 
 
@@ -43,6 +44,14 @@ enum
 #define FAIL	-1
 #define ARG_CNT_ERR -2;
 
+// registers fetched by one burst read, from I2C_INPORT_REG_ADD to I2C_PWM_FREQ
+#define MOSFET8_IMAGE_SIZE	(I2C_PWM_FREQ + PWM_SIZE_B)
+
+#define STACK_LEVELS	8
+
+#define MOS_MIN_FREQ 16
+#define MOS_MAX_FREQ 1000
+
 #define MOSFET8_HW_I2C_BASE_ADD	0x38
 #define MOSFET8_HW_I2C_ALTERNATE_BASE_ADD 0x20
 typedef uint8_t u8;
@@ -78,4 +87,91 @@ typedef struct
 		unsigned int add:8;
 	} ModbusSetingsType;
 
+typedef struct
+{
+	u8 extended; // 0 = plain I/O expander, only the first four fields are valid
+	u8 inport;
+	u8 outport;
+	u8 polinv;
+	u8 cfg;
+	u8 mosfets;
+	u16 diag3v3mV;
+	int8_t temperature;
+	u16 pwm[MOSFET_NO];
+	ModbusSetingsType modbus;
+	u16 pwmFreq;
+} MosfetImageType;
+
+typedef struct
+{
+	u8 extended; // 0 = plain I/O expander, only the mosfets are valid
+	u8 mosfets;
+	u16 diag3v3mV;
+	int8_t temperature;
+} MosfetDiagType;
+
+typedef struct
+{
+	u8 stack;
+	u8 hwAdd; // 7 bit slave address the board answered on
+	u8 alternate; // 1 if on MOSFET8_HW_I2C_ALTERNATE_BASE_ADD
+	u8 extended; // 0 = plain I/O expander, no revision registers
+	u8 hwMajor;
+	u8 hwMinor;
+	u8 fwMajor;
+	u8 fwMinor;
+} MosfetScanType;
+
+/*
+ * New state of one board for a synchronized update
+ */
+typedef struct
+{
+	u8 stack;
+	u8 mosfets; // bit 0 = mosfet 1
+	u8 pwmValid; // also set the pwm of the eight channels
+	u16 pwm[MOSFET_NO]; // fill factor in per mille
+} MosfetFrameType;
+
+typedef struct
+{
+	long long spanNs; // first output write start to last one end, skew upper bound
+	long long pwmSpanNs;
+	int transfers; // bus transfers used for the output writes
+} MosfetSyncStatType;
+
+/*
+ * Board protocol, board.c. "dev" is the handle returned by doBoardInit()
+ */
+int doBoardInit(int stack);
+void doBoardRelease(int drop);
+void doBoardForget(int stack);
+int outportRead(int dev, u8 *io, int cached);
+int outportWrite(int dev, u8 io);
+u8 mosfetToIO(u8 mosfet);
+u8 IOToMosfet(u8 io);
+int mosfetChSet(int dev, u8 channel, OutStateEnumType state);
+int mosfetChGet(int dev, u8 channel, OutStateEnumType *state);
+int mosfetChSetPwm(int dev, u8 channel, float value);
+int mosfetChGetPwm(int dev, u8 channel, float *value);
+int mosfetPwmSetAll(int dev, const u16 *perMille);
+int mosfetPwmGetAll(int dev, u16 *perMille);
+int mosfetSet(int dev, int val);
+int mosfetGet(int dev, int *val);
+int mosfetSetFrequency(int dev, int val);
+int mosfetGetFrequency(int dev, int *val);
+int cfg485Set(int dev, u8 mode, u32 baud, u8 stopB, u8 parity, u8 add);
+int cfg485Get(int dev, ModbusSetingsType *settings);
+int mosfetIsExtended(int dev);
+int mosfetImageRead(int dev, MosfetImageType *img);
+int mosfetDiagRead(int dev, MosfetDiagType *diag);
+void mosfetShadowConfig(int refreshMs);
+int mosfetScanConfig(const char *order);
+int mosfetScan(MosfetScanType *found);
+int mosfetSync(const MosfetFrameType *frames, int count,
+	MosfetSyncStatType *stat);
+int mosfetMaskApply(uint64_t set, uint64_t clr, uint64_t tog,
+	MosfetSyncStatType *stat);
+int mosfetMaskGet(uint64_t channels, uint64_t *state);
+
 #endif //MOSFET8_H_
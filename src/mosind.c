@@ -0,0 +1,693 @@
+/*
+ * mosind.c:
+ *	libmosind, the public C API: persistent board handles on top of the
+ *	board protocol, verified writes, error codes
+ *
+ *	Copyright (c) 2016-2023 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ *	Author: Alexandru Burcea
+ ***********************************************************************
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include "mosind.h"
+#include "mosfet.h"
+#include "comm.h"
+#include "emu.h"
+#include "inventory.h"
+#include "chmap.h"
+#include "retry.h"
+
+struct mosind
+{
+	int stack;
+};
+
+static int gInitState = 0; // 0 not done, 1 done, -1 invalid settings
+static int gLastError = MOSIND_ERR_NONE;
+
+/*
+ * backendInit:
+ *	MOSIND_BACKEND=emu runs every operation against the board emulator; not
+ *	for a setuid process, the emulator writes its image file
+ */
+static int backendInit(void)
+{
+	char *backend = secure_getenv("MOSIND_BACKEND");
+
+	if ( (NULL == backend) || (strcasecmp(backend, gI2cLinuxBackend.name) == 0))
+	{
+		return OK;
+	}
+	if (strcasecmp(backend, gI2cEmuBackend.name) == 0)
+	{
+		return i2cSetBackend(&gI2cEmuBackend);
+	}
+	printf("Invalid MOSIND_BACKEND \"%s\" (%s, %s)\n", backend,
+		gI2cLinuxBackend.name, gI2cEmuBackend.name);
+	return ERROR;
+}
+
+static int envInt(const char *name, int def)
+{
+	char *val = secure_getenv(name);
+
+	if (NULL == val)
+	{
+		return def;
+	}
+	return atoi(val);
+}
+
+/*
+ * envInit:
+ *	Load the tuning settings from the environment, MOSIND_RT_* are applied
+ *	by the application
+ */
+static int envInit(void)
+{
+	RetryPolicyType policy;
+	char *verify = secure_getenv("MOSIND_VERIFY");
+	char *lock = secure_getenv("MOSIND_LOCK_DIR");
+	int mode = 0;
+
+	if (NULL != lock)
+	{
+		i2cLockConfig(lock);
+	}
+	if (NULL != secure_getenv("MOSIND_GROUPS"))
+	{
+		chmapConfig(secure_getenv("MOSIND_GROUPS"));
+	}
+	if (NULL != secure_getenv("MOSIND_CACHE_DIR"))
+	{
+		inventoryConfig(secure_getenv("MOSIND_CACHE_DIR"));
+	}
+	if ( (NULL != secure_getenv("MOSIND_SCAN_ORDER"))
+		&& (OK != mosfetScanConfig(secure_getenv("MOSIND_SCAN_ORDER"))))
+	{
+		printf("Invalid MOSIND_SCAN_ORDER \"%s\" (pa, ap, p, a)\n",
+			secure_getenv("MOSIND_SCAN_ORDER"));
+		return ERROR;
+	}
+	if (NULL != secure_getenv("MOSIND_SHADOW_MS"))
+	{
+		mosfetShadowConfig(envInt("MOSIND_SHADOW_MS", 0));
+	}
+	memcpy(&policy, retryPolicyGet(), sizeof(RetryPolicyType));
+	if (NULL != verify)
+	{
+		mode = retryVerifyParse(verify);
+		if (mode < 0)
+		{
+			printf("Invalid MOSIND_VERIFY \"%s\" (none, each, end)\n", verify);
+			return ERROR;
+		}
+		policy.verify = (VerifyModeType)mode;
+	}
+	policy.attempts = envInt("MOSIND_RETRIES", policy.attempts);
+	policy.backoffUs = envInt("MOSIND_BACKOFF_US", policy.backoffUs);
+	policy.backoffMaxUs = envInt("MOSIND_BACKOFF_MAX_US", policy.backoffMaxUs);
+	retryPolicySet(&policy);
+	if ( (NULL != secure_getenv("MOSIND_I2C_TIMEOUT_MS"))
+		|| (NULL != secure_getenv("MOSIND_I2C_RETRIES")))
+	{
+		i2cBusConfig(envInt("MOSIND_I2C_TIMEOUT_MS", -1),
+			envInt("MOSIND_I2C_RETRIES", -1));
+	}
+	return OK;
+}
+
+/*
+ * Verified write operations for retryRun()
+ */
+typedef struct
+{
+	u8 channel;
+	OutStateEnumType state;
+} ChStateArgType;
+
+typedef struct
+{
+	u8 channel;
+	float value;
+} PwmArgType;
+
+static int chSetOp(int dev, const void *arg)
+{
+	const ChStateArgType *a = arg;
+
+	return mosfetChSet(dev, a->channel, a->state);
+}
+
+static int chCheckOp(int dev, const void *arg)
+{
+	const ChStateArgType *a = arg;
+	OutStateEnumType state = STATE_COUNT;
+
+	if (OK != mosfetChGet(dev, a->channel, &state))
+	{
+		return FAIL;
+	}
+	return state == a->state ? OK : RETRY_MISMATCH;
+}
+
+static int portSetOp(int dev, const void *arg)
+{
+	return mosfetSet(dev, *(const int *)arg);
+}
+
+static int portCheckOp(int dev, const void *arg)
+{
+	int val = 0;
+
+	if (OK != mosfetGet(dev, &val))
+	{
+		return FAIL;
+	}
+	return val == *(const int *)arg ? OK : RETRY_MISMATCH;
+}
+
+static int pwmSetOp(int dev, const void *arg)
+{
+	const PwmArgType *a = arg;
+
+	return mosfetChSetPwm(dev, a->channel, a->value);
+}
+
+static int pwmCheckOp(int dev, const void *arg)
+{
+	const PwmArgType *a = arg;
+	float value = 0;
+	float expected = a->value;
+
+	if (OK != mosfetChGetPwm(dev, a->channel, &value))
+	{
+		return FAIL;
+	}
+	// compare the register content, not the floats
+	if (expected > 100)
+	{
+		expected = 100;
+	}
+	if (expected < 0)
+	{
+		expected = 0;
+	}
+	return (uint16_t)(value * 10 + 0.5) == (uint16_t)(expected * 10) ?
+		OK : RETRY_MISMATCH;
+}
+
+static int pwmAllSetOp(int dev, const void *arg)
+{
+	return mosfetPwmSetAll(dev, arg);
+}
+
+static int pwmAllCheckOp(int dev, const void *arg)
+{
+	u16 perMille[MOSFET_NO];
+
+	if (OK != mosfetPwmGetAll(dev, perMille))
+	{
+		return FAIL;
+	}
+	return memcmp(perMille, arg, sizeof(perMille)) == 0 ? OK : RETRY_MISMATCH;
+}
+
+/*
+ * mosind_init:
+ *	Apply the MOSIND_* settings of the environment, once. Called by the first
+ *	mosind_open(), call it first to change the settings from the code after
+ */
+int mosind_init(void)
+{
+	if (gInitState == 0)
+	{
+		gInitState = ( (OK == backendInit()) && (OK == envInit())) ? 1 : -1;
+	}
+	gLastError = gInitState > 0 ? MOSIND_ERR_NONE : MOSIND_ERR_ARG;
+	return gInitState > 0 ? OK : ERROR;
+}
+
+/*
+ * boardDev:
+ *	The bus handle of an open board, no transaction once the board is known
+ */
+static int boardDev(const mosind_t *h)
+{
+	int dev;
+
+	if (NULL == h)
+	{
+		gLastError = MOSIND_ERR_ARG;
+		return ERROR;
+	}
+	dev = doBoardInit(h->stack);
+	if (dev <= 0)
+	{
+		gLastError = i2cLastError() == I2C_ERR_FATAL ? MOSIND_ERR_FATAL :
+			MOSIND_ERR_NODEV;
+		return ERROR;
+	}
+	gLastError = MOSIND_ERR_NONE;
+	return dev;
+}
+
+/*
+ * failed:
+ *	Record why an operation failed; after a communication error the board is
+ *	forgotten, the next operation detects it again
+ */
+static int failed(const mosind_t *h, int err)
+{
+	gLastError = err;
+	if ( (err == MOSIND_ERR_NACK) || (err == MOSIND_ERR_BUS)
+		|| (err == MOSIND_ERR_FATAL))
+	{
+		doBoardForget(h->stack);
+	}
+	return ERROR;
+}
+
+static int commFailed(const mosind_t *h)
+{
+	switch (i2cLastError())
+	{
+	case I2C_ERR_NACK:
+		return failed(h, MOSIND_ERR_NACK);
+	case I2C_ERR_BUS:
+		return failed(h, MOSIND_ERR_BUS);
+	case I2C_ERR_FATAL:
+		return failed(h, MOSIND_ERR_FATAL);
+	default:
+		break;
+	}
+	return failed(h, MOSIND_ERR_ARG); // refused before any transaction
+}
+
+static int retryFailed(const mosind_t *h)
+{
+	switch (retryLastError())
+	{
+	case RETRY_ERR_NACK:
+		return failed(h, MOSIND_ERR_NACK);
+	case RETRY_ERR_BUS:
+		return failed(h, MOSIND_ERR_BUS);
+	case RETRY_ERR_MISMATCH:
+		return failed(h, MOSIND_ERR_MISMATCH);
+	case RETRY_ERR_FATAL:
+		return failed(h, MOSIND_ERR_FATAL);
+	default:
+		break;
+	}
+	return failed(h, MOSIND_ERR_ARG);
+}
+
+static int verifiedWrite(const mosind_t *h, int dev, RetryOpType *op)
+{
+	op->dev = dev;
+	if (OK != retryRun(op, 1))
+	{
+		return retryFailed(h);
+	}
+	return OK;
+}
+
+static int argError(void)
+{
+	gLastError = MOSIND_ERR_ARG;
+	return ERROR;
+}
+
+/*
+ * mosind_open:
+ *	Detect and initialize the board at "stack" level (0..7), return NULL if
+ *	there is none. The board stays initialized in the process after
+ *	mosind_close(), until mosind_release()
+ */
+mosind_t* mosind_open(int stack)
+{
+	mosind_t *h = NULL;
+
+	if (OK != mosind_init())
+	{
+		return NULL;
+	}
+	if ( (stack < 0) || (stack >= STACK_LEVELS))
+	{
+		argError();
+		return NULL;
+	}
+	h = malloc(sizeof(mosind_t));
+	if (NULL == h)
+	{
+		argError();
+		return NULL;
+	}
+	h->stack = stack;
+	if (ERROR == boardDev(h))
+	{
+		free(h);
+		inventoryFlush();
+		return NULL;
+	}
+	inventoryFlush();
+	return h;
+}
+
+void mosind_close(mosind_t *h)
+{
+	free(h);
+	inventoryFlush();
+}
+
+/*
+ * mosind_release:
+ *	Close every board and bus of the process
+ */
+void mosind_release(void)
+{
+	doBoardRelease(0);
+	i2cCloseAll();
+}
+
+int mosind_stack(const mosind_t *h)
+{
+	return NULL == h ? ERROR : h->stack;
+}
+
+/*
+ * mosind_is_extended:
+ *	1 for a board with pwm, frequency and RS485, 0 for a plain I/O expander
+ */
+int mosind_is_extended(mosind_t *h)
+{
+	int dev = boardDev(h);
+	int ret;
+
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	ret = mosfetIsExtended(dev);
+	inventoryFlush();
+	return ret;
+}
+
+int mosind_set_mask(mosind_t *h, uint8_t mask)
+{
+	int dev = boardDev(h);
+	int val = mask;
+	RetryOpType op;
+
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	op.write = &portSetOp;
+	op.check = &portCheckOp;
+	op.arg = &val;
+	op.size = sizeof(val);
+	return verifiedWrite(h, dev, &op);
+}
+
+int mosind_get_mask(mosind_t *h, uint8_t *mask)
+{
+	int dev = boardDev(h);
+	int val = 0;
+
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if (NULL == mask)
+	{
+		return argError();
+	}
+	if (OK != mosfetGet(dev, &val))
+	{
+		return commFailed(h);
+	}
+	*mask = (uint8_t)val;
+	return OK;
+}
+
+int mosind_set_channel(mosind_t *h, int channel, int on)
+{
+	int dev = boardDev(h);
+	ChStateArgType chArg;
+	RetryOpType op;
+
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if ( (channel < CHANNEL_NR_MIN) || (channel > MOSFET_CH_NR_MAX))
+	{
+		return argError();
+	}
+	chArg.channel = channel;
+	chArg.state = on ? ON : OFF;
+	op.write = &chSetOp;
+	op.check = &chCheckOp;
+	op.arg = &chArg;
+	op.size = sizeof(chArg);
+	return verifiedWrite(h, dev, &op);
+}
+
+int mosind_get_channel(mosind_t *h, int channel, int *on)
+{
+	int dev = boardDev(h);
+	OutStateEnumType state = STATE_COUNT;
+
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if ( (NULL == on) || (channel < CHANNEL_NR_MIN)
+		|| (channel > MOSFET_CH_NR_MAX))
+	{
+		return argError();
+	}
+	if (OK != mosfetChGet(dev, channel, &state))
+	{
+		return commFailed(h);
+	}
+	*on = state == ON;
+	return OK;
+}
+
+int mosind_pwm_write(mosind_t *h, int channel, int perMille)
+{
+	int dev = boardDev(h);
+	PwmArgType pwmArg;
+	RetryOpType op;
+
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if ( (channel < CHANNEL_NR_MIN) || (channel > MOSFET_CH_NR_MAX)
+		|| (perMille < 0) || (perMille > PWM_MAX_PERMILLE))
+	{
+		return argError();
+	}
+	pwmArg.channel = channel;
+	// +0.5 so the per mille value survives the float round trip
+	pwmArg.value = (perMille + 0.5f) / 10;
+	op.write = &pwmSetOp;
+	op.check = &pwmCheckOp;
+	op.arg = &pwmArg;
+	op.size = sizeof(pwmArg);
+	return verifiedWrite(h, dev, &op);
+}
+
+int mosind_pwm_read(mosind_t *h, int channel, int *perMille)
+{
+	int dev = boardDev(h);
+	float value = 0;
+
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if ( (NULL == perMille) || (channel < CHANNEL_NR_MIN)
+		|| (channel > MOSFET_CH_NR_MAX))
+	{
+		return argError();
+	}
+	if (OK != mosfetChGetPwm(dev, channel, &value))
+	{
+		return commFailed(h);
+	}
+	*perMille = (int)(value * 10 + 0.5);
+	return OK;
+}
+
+int mosind_pwm_write_all(mosind_t *h, const uint16_t perMille[MOSIND_CHANNELS])
+{
+	int dev = boardDev(h);
+	RetryOpType op;
+	int i;
+
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if (NULL == perMille)
+	{
+		return argError();
+	}
+	for (i = 0; i < MOSFET_NO; i++)
+	{
+		if (perMille[i] > PWM_MAX_PERMILLE)
+		{
+			return argError();
+		}
+	}
+	op.write = &pwmAllSetOp;
+	op.check = &pwmAllCheckOp;
+	op.arg = perMille;
+	op.size = MOSFET_NO * sizeof(uint16_t);
+	return verifiedWrite(h, dev, &op);
+}
+
+int mosind_pwm_read_all(mosind_t *h, uint16_t perMille[MOSIND_CHANNELS])
+{
+	int dev = boardDev(h);
+
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if (NULL == perMille)
+	{
+		return argError();
+	}
+	if (OK != mosfetPwmGetAll(dev, perMille))
+	{
+		return commFailed(h);
+	}
+	return OK;
+}
+
+int mosind_freq_write(mosind_t *h, int hz)
+{
+	int dev = boardDev(h);
+
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if ( (hz < MOS_MIN_FREQ) || (hz > MOS_MAX_FREQ))
+	{
+		return argError();
+	}
+	if (OK != mosfetSetFrequency(dev, hz))
+	{
+		return commFailed(h);
+	}
+	return OK;
+}
+
+int mosind_freq_read(mosind_t *h, int *hz)
+{
+	int dev = boardDev(h);
+
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if (NULL == hz)
+	{
+		return argError();
+	}
+	if (OK != mosfetGetFrequency(dev, hz))
+	{
+		return commFailed(h);
+	}
+	return OK;
+}
+
+int mosind_rs485_write(mosind_t *h, const mosind_rs485_t *cfg)
+{
+	int dev = boardDev(h);
+
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if ( (NULL == cfg) || (cfg->mode < 0) || (cfg->mode > 1)
+		|| (cfg->baud < 1200) || (cfg->baud > 921600) || (cfg->stopBits < 1)
+		|| (cfg->stopBits > 2) || (cfg->parity < 0) || (cfg->parity > 2)
+		|| (cfg->address < 1) || (cfg->address > 255))
+	{
+		return argError();
+	}
+	if (OK != cfg485Set(dev, (u8)cfg->mode, (u32)cfg->baud, (u8)cfg->stopBits,
+		(u8)cfg->parity, (u8)cfg->address))
+	{
+		return commFailed(h);
+	}
+	return OK;
+}
+
+int mosind_rs485_read(mosind_t *h, mosind_rs485_t *cfg)
+{
+	int dev = boardDev(h);
+	ModbusSetingsType settings;
+
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if (NULL == cfg)
+	{
+		return argError();
+	}
+	if (OK != cfg485Get(dev, &settings))
+	{
+		return commFailed(h);
+	}
+	cfg->mode = settings.mbType;
+	cfg->baud = settings.mbBaud;
+	cfg->stopBits = settings.mbStopB;
+	cfg->parity = settings.mbParity;
+	cfg->address = settings.add;
+	return OK;
+}
+
+int mosind_last_error(void)
+{
+	return gLastError;
+}
+
+const char* mosind_strerror(int err)
+{
+	switch (err)
+	{
+	case MOSIND_ERR_NONE:
+		return "ok";
+	case MOSIND_ERR_ARG:
+		return "invalid argument";
+	case MOSIND_ERR_NODEV:
+		return "board not detected";
+	case MOSIND_ERR_NACK:
+		return "no acknowledge";
+	case MOSIND_ERR_BUS:
+		return "bus error";
+	case MOSIND_ERR_MISMATCH:
+		return "read back mismatch";
+	case MOSIND_ERR_FATAL:
+		return "bus not usable";
+	default:
+		break;
+	}
+	return "invalid request";
+}
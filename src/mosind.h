@@ -0,0 +1,84 @@
+#ifndef MOSIND_H_
+#define MOSIND_H_
+
+/*
+ * libmosind: C API of the Sequent Microsystems 8-MOSFETS stackable board.
+ *
+ * A handle is opened once per board and kept, the board detection and init
+ * are done by mosind_open() only; every later call is just the register
+ * transactions of the operation. The writes are verified and retried with
+ * the MOSIND_VERIFY / MOSIND_RETRIES policy, the settings come from the same
+ * MOSIND_* environment variables as the 8mosind command.
+ *
+ * The library keeps per process state, the calls must be serialized by the
+ * caller. Functions returning int return 0 on success and -1 on failure,
+ * mosind_last_error() tells why
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MOSIND_API	__attribute__((visibility("default")))
+
+#define MOSIND_STACK_LEVELS	8
+#define MOSIND_CHANNELS		8
+#define MOSIND_PWM_MAX		1000	/* fill factor unit is per mille */
+#define MOSIND_FREQ_MIN		16
+#define MOSIND_FREQ_MAX		1000
+
+// mosind_last_error() codes
+
+#define MOSIND_ERR_NONE		0
+#define MOSIND_ERR_ARG		1	/* invalid argument or handle */
+#define MOSIND_ERR_NODEV	2	/* no board at this stack level */
+#define MOSIND_ERR_NACK		3	/* the board did not answer */
+#define MOSIND_ERR_BUS		4	/* timeout, arbitration lost, I/O error */
+#define MOSIND_ERR_MISMATCH	5	/* read back differs after all the retries */
+#define MOSIND_ERR_FATAL	6	/* bus not usable */
+
+typedef struct mosind mosind_t;
+
+typedef struct
+{
+	int mode; // 0 disabled, 1 MODBUS RTU slave
+	int baud; // 1200..921600
+	int stopBits; // 1, 2
+	int parity; // 0 none, 1 even, 2 odd
+	int address; // MODBUS slave address 1..255
+} mosind_rs485_t;
+
+MOSIND_API int mosind_init(void);
+MOSIND_API mosind_t* mosind_open(int stack);
+MOSIND_API void mosind_close(mosind_t *h);
+MOSIND_API void mosind_release(void);
+MOSIND_API int mosind_stack(const mosind_t *h);
+MOSIND_API int mosind_is_extended(mosind_t *h);
+
+MOSIND_API int mosind_set_mask(mosind_t *h, uint8_t mask);
+MOSIND_API int mosind_get_mask(mosind_t *h, uint8_t *mask);
+MOSIND_API int mosind_set_channel(mosind_t *h, int channel, int on);
+MOSIND_API int mosind_get_channel(mosind_t *h, int channel, int *on);
+
+MOSIND_API int mosind_pwm_write(mosind_t *h, int channel, int perMille);
+MOSIND_API int mosind_pwm_read(mosind_t *h, int channel, int *perMille);
+MOSIND_API int mosind_pwm_write_all(mosind_t *h,
+	const uint16_t perMille[MOSIND_CHANNELS]);
+MOSIND_API int mosind_pwm_read_all(mosind_t *h,
+	uint16_t perMille[MOSIND_CHANNELS]);
+MOSIND_API int mosind_freq_write(mosind_t *h, int hz);
+MOSIND_API int mosind_freq_read(mosind_t *h, int *hz);
+
+MOSIND_API int mosind_rs485_write(mosind_t *h, const mosind_rs485_t *cfg);
+MOSIND_API int mosind_rs485_read(mosind_t *h, mosind_rs485_t *cfg);
+
+MOSIND_API int mosind_last_error(void);
+MOSIND_API const char* mosind_strerror(int err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //MOSIND_H_
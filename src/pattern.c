@@ -0,0 +1,492 @@
+/*
+ * pattern.c:
+ *	Timed output sequences: compile a text pattern to the binary format and
+ *	play a binary pattern with absolute deadlines
+ *
+ *	Copyright (c) 2016-2023 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ *	Author: Alexandru Burcea
+ ***********************************************************************
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/fsuid.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mosfet.h"
+#include "thread.h"
+#include "pattern.h"
+
+#define PATTERN_LINE_SIZE	256
+#define PATTERN_TOKENS		12
+#define PATTERN_LEAD_US		1000	/* first deadline after the start */
+
+static volatile sig_atomic_t gStop = 0;
+
+static void patternSignal(int sig)
+{
+	(void)sig;
+	gStop = 1;
+}
+
+/*
+ * asRealUser / asSetUser:
+ *	Switch the filesystem ids to the user who runs the command and back, so a
+ *	setuid install reads, creates and replaces only the files that user may
+ */
+static void asRealUser(uid_t *uid, gid_t *gid)
+{
+	*uid = setfsuid(getuid());
+	*gid = setfsgid(getgid());
+}
+
+static void asSetUser(uid_t uid, gid_t gid)
+{
+	setfsgid(gid);
+	setfsuid(uid);
+}
+
+static int parseMs(const char *arg, uint64_t *us)
+{
+	char *end = NULL;
+	double ms = strtod(arg, &end);
+
+	if ( (end == arg) || (*end != 0) || (ms < 0))
+	{
+		return ERROR;
+	}
+	*us = (uint64_t)(ms * 1000 + 0.5);
+	return OK;
+}
+
+static int parsePercent(const char *arg, uint16_t *perMille)
+{
+	char *end = NULL;
+	double val = strtod(arg, &end);
+
+	if ( (end == arg) || (*end != 0) || (val < 0) || (val > 100))
+	{
+		return ERROR;
+	}
+	*perMille = (uint16_t)(val * 10 + 0.5);
+	return OK;
+}
+
+/*
+ * patternParse:
+ *	Fill "rec" from one source line:
+ *	<ms> <id> write <value>
+ *	<ms> <id> pwmwr <channel> <0..100>
+ *	<ms> <id> pwmwr all <ch1> .. <ch8>
+ */
+static int patternParse(char **tok, int n, PatternRecordType *rec)
+{
+	char *end = NULL;
+	long val;
+	int i;
+
+	memset(rec, 0, sizeof(PatternRecordType));
+	if ( (n < 4) || (OK != parseMs(tok[0], &rec->timeUs)))
+	{
+		return ERROR;
+	}
+	val = strtol(tok[1], &end, 10);
+	if ( (end == tok[1]) || (*end != 0) || (val < 0) || (val > 7))
+	{
+		return ERROR;
+	}
+	rec->stack = (uint8_t)val;
+	if ( (strcasecmp(tok[2], "write") == 0) && (n == 4))
+	{
+		val = strtol(tok[3], &end, 0);
+		if ( (end == tok[3]) || (*end != 0) || (val < 0) || (val > 255))
+		{
+			return ERROR;
+		}
+		rec->type = PATTERN_REC_MASK;
+		rec->mask = (uint8_t)val;
+		return OK;
+	}
+	if (strcasecmp(tok[2], "pwmwr") != 0)
+	{
+		return ERROR;
+	}
+	rec->type = PATTERN_REC_PWM;
+	if ( (strcasecmp(tok[3], "all") == 0) && (n == 4 + MOSFET_NO))
+	{
+		for (i = 0; i < MOSFET_NO; i++)
+		{
+			if (OK != parsePercent(tok[4 + i], &rec->pwm[i]))
+			{
+				return ERROR;
+			}
+		}
+		return OK;
+	}
+	val = strtol(tok[3], &end, 10);
+	if ( (n != 5) || (end == tok[3]) || (*end != 0) || (val < CHANNEL_NR_MIN)
+		|| (val > MOSFET_CH_NR_MAX))
+	{
+		return ERROR;
+	}
+	rec->channel = (uint8_t)val;
+	return parsePercent(tok[4], &rec->pwm[val - 1]);
+}
+
+/*
+ * patternBuild:
+ *	Translate a text pattern, one record per line sorted by time in
+ *	milliseconds, and an optional "period <ms>" loop length line. The period
+ *	must end after the last record, so its state is shown before the loop
+ *	restarts; the default one adds the last step of the pattern once more.
+ *	The output is written to a new temporary file renamed over dst at the
+ *	end, so only a file created here is ever removed
+ */
+static int patternBuild(const char *src, const char *dst)
+{
+	PatternHeaderType hdr;
+	PatternRecordType rec;
+	char line[PATTERN_LINE_SIZE];
+	char *tok[PATTERN_TOKENS];
+	char *save = NULL;
+	char tmp[PATH_MAX];
+	char *p = NULL;
+	FILE *in = NULL;
+	FILE *out = NULL;
+	uint64_t last = 0;
+	uint64_t step = 0;
+	int lineNr = 0;
+	int fd;
+	int n;
+
+	fd = open(src, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	in = fd < 0 ? NULL : fdopen(fd, "r");
+	if (NULL == in)
+	{
+		printf("Fail to open %s\n", src);
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return ERROR;
+	}
+	fd = -1;
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", dst) < (int)sizeof(tmp))
+	{
+		fd = mkostemp(tmp, O_CLOEXEC);
+	}
+	if ( (fd >= 0) && (fchmod(fd, 0644) < 0))
+	{
+		close(fd);
+		unlink(tmp);
+		fd = -1;
+	}
+	out = fd < 0 ? NULL : fdopen(fd, "w");
+	if (NULL == out)
+	{
+		printf("Fail to create %s\n", dst);
+		if (fd >= 0)
+		{
+			close(fd);
+			unlink(tmp);
+		}
+		fclose(in);
+		return ERROR;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PATTERN_MAGIC, sizeof(hdr.magic));
+	hdr.version = PATTERN_VERSION;
+	hdr.recordSize = sizeof(PatternRecordType);
+	fwrite(&hdr, sizeof(hdr), 1, out); // placeholder, the counts are known at the end
+
+	while (NULL != fgets(line, sizeof(line), in))
+	{
+		lineNr++;
+		p = strchr(line, '#');
+		if (NULL != p)
+		{
+			*p = 0;
+		}
+		n = 0;
+		for (p = strtok_r(line, " \t\r\n", &save); (NULL != p) && (n < PATTERN_TOKENS);
+			p = strtok_r(NULL, " \t\r\n", &save))
+		{
+			tok[n++] = p;
+		}
+		if (n == 0)
+		{
+			continue;
+		}
+		if ( (strcasecmp(tok[0], "period") == 0) && (n == 2)
+			&& (OK == parseMs(tok[1], &hdr.periodUs)))
+		{
+			continue;
+		}
+		if (OK != patternParse(tok, n, &rec))
+		{
+			printf("%s:%d: invalid record\n", src, lineNr);
+			break;
+		}
+		if (rec.timeUs < last)
+		{
+			printf("%s:%d: records not sorted by time\n", src, lineNr);
+			break;
+		}
+		if (rec.timeUs > last)
+		{
+			step = rec.timeUs - last;
+		}
+		last = rec.timeUs;
+		if (fwrite(&rec, sizeof(rec), 1, out) != 1)
+		{
+			printf("Fail to write %s\n", dst);
+			break;
+		}
+		hdr.count++;
+		hdr.boards |= 1 << rec.stack;
+	}
+	if (!feof(in))
+	{
+		fclose(in);
+		fclose(out);
+		unlink(tmp);
+		return ERROR;
+	}
+	fclose(in);
+	if (hdr.periodUs == 0)
+	{
+		hdr.periodUs = last + step;
+	}
+	if ( (hdr.periodUs == 0) || (hdr.periodUs <= last))
+	{
+		printf(step == 0 ? "A single time slot needs a \"period <ms>\" line\n" :
+			"The period must end after the last record\n");
+		fclose(out);
+		unlink(tmp);
+		return ERROR;
+	}
+	if ( (fseek(out, 0, SEEK_SET) != 0) || (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+		|| (fclose(out) != 0) || (rename(tmp, dst) != 0))
+	{
+		printf("Fail to write %s\n", dst);
+		unlink(tmp);
+		return ERROR;
+	}
+	printf("%u records, %.3f ms period\n", hdr.count, hdr.periodUs / 1000.0);
+	return OK;
+}
+
+/*
+ * patternCompile:
+ *	Build a pattern file with the permissions of the user who runs the command
+ */
+int patternCompile(const char *src, const char *dst)
+{
+	uid_t uid;
+	gid_t gid;
+	int ret;
+
+	asRealUser(&uid, &gid);
+	ret = patternBuild(src, dst);
+	asSetUser(uid, gid);
+	return ret;
+}
+
+/*
+ * patternOpen:
+ *	Map a compiled pattern read only, the records are paged in by the kernel
+ *	as the player walks them, whatever the length of the sequence
+ */
+int patternOpen(const char *path, PatternType *pat)
+{
+	struct stat st;
+	void *map = NULL;
+	uid_t uid;
+	gid_t gid;
+
+	memset(pat, 0, sizeof(PatternType));
+	asRealUser(&uid, &gid);
+	pat->fd = open(path, O_RDONLY | O_CLOEXEC);
+	asSetUser(uid, gid);
+	if (pat->fd < 0)
+	{
+		printf("Fail to open %s\n", path);
+		return ERROR;
+	}
+	if ( (fstat(pat->fd, &st) < 0) || ((size_t)st.st_size < sizeof(PatternHeaderType)))
+	{
+		printf("Invalid pattern file %s\n", path);
+		close(pat->fd);
+		return ERROR;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, pat->fd, 0);
+	if (MAP_FAILED == map)
+	{
+		printf("Fail to map %s\n", path);
+		close(pat->fd);
+		return ERROR;
+	}
+	pat->size = st.st_size;
+	pat->hdr = map;
+	pat->rec = (const PatternRecordType*)(pat->hdr + 1);
+	if ( (memcmp(pat->hdr->magic, PATTERN_MAGIC, sizeof(pat->hdr->magic)) != 0)
+		|| (pat->hdr->version != PATTERN_VERSION)
+		|| (pat->hdr->recordSize != sizeof(PatternRecordType))
+		|| ( (pat->size - sizeof(PatternHeaderType)) / sizeof(PatternRecordType)
+			< pat->hdr->count))
+	{
+		printf("Invalid pattern file %s\n", path);
+		patternClose(pat);
+		return ERROR;
+	}
+	madvise(map, pat->size, MADV_SEQUENTIAL);
+	return OK;
+}
+
+void patternClose(PatternType *pat)
+{
+	if (NULL != pat->hdr)
+	{
+		munmap((void*)pat->hdr, pat->size);
+		pat->hdr = NULL;
+		pat->rec = NULL;
+	}
+	if (pat->fd >= 0)
+	{
+		close(pat->fd);
+		pat->fd = -1;
+	}
+}
+
+static long long tsDiffNs(const struct timespec *a, const struct timespec *b)
+{
+	return (long long)(a->tv_sec - b->tv_sec) * 1000000000LL
+		+ (a->tv_nsec - b->tv_nsec);
+}
+
+/*
+ * patternPlay:
+ *	Output every record at start + loop * period + record time. The deadlines
+ *	are absolute, a late record does not delay the next ones. "repeat" = 0
+ *	loops until SIGINT/SIGTERM, that end the play and keep the statistics.
+ *	A repeated pattern needs a period ending after its last record
+ */
+int patternPlay(const PatternType *pat, int repeat, PatternOutputType out,
+	PatternStatsType *stats)
+{
+	struct sigaction sa;
+	struct sigaction oldInt;
+	struct sigaction oldTerm;
+	struct timespec start;
+	struct timespec deadline;
+	struct timespec now;
+	const PatternRecordType *rec = NULL;
+	long long late;
+	uint32_t i;
+	int loop;
+
+	memset(stats, 0, sizeof(PatternStatsType));
+	if ( (NULL == pat->hdr) || (pat->hdr->count == 0) || (NULL == out))
+	{
+		return ERROR;
+	}
+	if ( (repeat != 1)
+		&& (pat->hdr->periodUs <= pat->rec[pat->hdr->count - 1].timeUs))
+	{
+		printf("The pattern period does not end after its last record, compile it again\n");
+		return ERROR;
+	}
+	gStop = 0;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = patternSignal; // no SA_RESTART, the sleep must be interrupted
+	sigaction(SIGINT, &sa, &oldInt);
+	sigaction(SIGTERM, &sa, &oldTerm);
+
+	deadlineNow(&start);
+	deadlineAdd(&start, PATTERN_LEAD_US);
+	for (loop = 0; ( (repeat == 0) || (loop < repeat)) && !gStop; loop++)
+	{
+		for (i = 0; (i < pat->hdr->count) && !gStop; i++)
+		{
+			rec = &pat->rec[i];
+			stats->records++;
+			if ( (i > 0) && (rec->timeUs == pat->rec[i - 1].timeUs))
+			{
+				// same time slot as the previous record, written right after it
+				if (OK != out(rec))
+				{
+					stats->errors++;
+				}
+				continue;
+			}
+			deadline = start;
+			deadlineAdd(&deadline,
+				(long long)(loop * pat->hdr->periodUs + rec->timeUs));
+			deadlineNow(&now);
+			if (tsDiffNs(&now, &deadline) > 0)
+			{
+				stats->misses++; // the previous writes ran over this deadline
+			}
+			else
+			{
+				while ( (waitUntil(&deadline) < 0) && !gStop)
+					;
+				if (gStop)
+				{
+					break;
+				}
+				deadlineNow(&now);
+			}
+			late = tsDiffNs(&now, &deadline);
+			if ( (stats->slots == 0) || (late < stats->lateMinNs))
+			{
+				stats->lateMinNs = late;
+			}
+			if (late > stats->lateMaxNs)
+			{
+				stats->lateMaxNs = late;
+			}
+			stats->lateSumNs += late;
+			stats->lateSqSumNs += (double)late * late;
+			stats->slots++;
+			if (OK != out(rec))
+			{
+				stats->errors++;
+			}
+		}
+	}
+	deadlineNow(&now);
+	stats->elapsedNs = tsDiffNs(&now, &start);
+	sigaction(SIGINT, &oldInt, NULL);
+	sigaction(SIGTERM, &oldTerm, NULL);
+	return stats->errors == 0 ? OK : FAIL;
+}
+
+void patternReport(const PatternStatsType *stats)
+{
+	double avg = 0;
+	double dev = 0;
+
+	printf("%lu records in %lu time slots, %.3f s, %lu deadline misses, %lu write errors\n",
+		stats->records, stats->slots, stats->elapsedNs / 1e9, stats->misses,
+		stats->errors);
+	if (stats->slots == 0)
+	{
+		return;
+	}
+	avg = stats->lateSumNs / stats->slots;
+	dev = stats->lateSqSumNs / stats->slots - avg * avg;
+	dev = dev > 0 ? sqrt(dev) : 0;
+	printf("Lateness (us): min %.1f, avg %.1f, max %.1f, jitter (std dev) %.1f\n",
+		stats->lateMinNs / 1e3, avg / 1e3, stats->lateMaxNs / 1e3, dev / 1e3);
+}
@@ -0,0 +1,72 @@
+#ifndef PATTERN_H_
+#define PATTERN_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Compiled pattern file, little endian: one header followed by "count"
+ * records sorted by time
+ */
+#define PATTERN_MAGIC	"8MPT"
+#define PATTERN_VERSION	1
+
+#define PATTERN_REC_MASK	1	/* set the mosfets state of one board */
+#define PATTERN_REC_PWM		2	/* set one (channel 1..8) or all (channel 0) pwm */
+
+// naturally aligned, no padding, so the mapped records can be used in place
+
+typedef struct
+{
+	char magic[4];
+	uint16_t version;
+	uint16_t recordSize;
+	uint32_t count;
+	uint8_t boards; // bit n set if stack level n is used
+	uint8_t reserved[3];
+	uint64_t periodUs; // loop length when repeated
+} PatternHeaderType;
+
+typedef struct
+{
+	uint64_t timeUs; // from the start of the loop
+	uint8_t stack;
+	uint8_t type;
+	uint8_t channel;
+	uint8_t mask; // PATTERN_REC_MASK: bit 0 = mosfet 1
+	uint16_t pwm[8]; // PATTERN_REC_PWM: fill factor in per mille
+	uint32_t reserved;
+} PatternRecordType;
+
+typedef struct
+{
+	int fd;
+	size_t size;
+	const PatternHeaderType *hdr;
+	const PatternRecordType *rec;
+} PatternType;
+
+typedef struct
+{
+	unsigned long records;
+	unsigned long slots; // distinct deadlines, the lateness is measured on them
+	unsigned long misses; // time slots reached after their deadline
+	unsigned long errors; // failed writes
+	long long lateMinNs;
+	long long lateMaxNs;
+	double lateSumNs;
+	double lateSqSumNs;
+	long long elapsedNs;
+} PatternStatsType;
+
+// put one record on the boards, return OK or FAIL
+typedef int (*PatternOutputType)(const PatternRecordType *rec);
+
+int patternCompile(const char *src, const char *dst);
+int patternOpen(const char *path, PatternType *pat);
+void patternClose(PatternType *pat);
+int patternPlay(const PatternType *pat, int repeat, PatternOutputType out,
+	PatternStatsType *stats);
+void patternReport(const PatternStatsType *stats);
+
+#endif //PATTERN_H_
@@ -0,0 +1,409 @@
+/*
+ * retry.c:
+ *	Verified writes with bounded retry and exponential backoff
+ *
+ *	Copyright (c) 2016-2023 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ *	Author: Alexandru Burcea
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "mosfet.h"
+#include "comm.h"
+#include "retry.h"
+
+#define BACKOFF_US		100
+#define BACKOFF_MAX_US	20000
+#define BACKOFF_LIMIT_US	1000000	/* upper bound of any setting */
+#define ATTEMPTS_MAX	100
+
+static RetryPolicyType gPolicy =
+{
+	VERIFY_EACH,
+	RETRY_TIMES,
+	BACKOFF_US,
+	BACKOFF_MAX_US};
+
+static RetryErrType gLastErr = RETRY_ERR_NONE;
+
+static const char *verifyNames[VERIFY_COUNT] = {"none", "each", "end"};
+
+/*
+ * Writes whose VERIFY_END read back is deferred until retryFlush(), between
+ * retryDeferBegin() and retryDeferEnd()
+ */
+#define RETRY_DEFER_MAX	64
+
+static int gDefer = 0;
+static int gDeferred = 0;
+static RetryErrType gDeferErr = RETRY_ERR_NONE;
+static RetryOpType gDeferOp[RETRY_DEFER_MAX];
+static unsigned char gDeferArg[RETRY_DEFER_MAX][RETRY_ARG_MAX];
+
+void retryPolicySet(const RetryPolicyType *policy)
+{
+	if (NULL == policy)
+	{
+		return;
+	}
+	memcpy(&gPolicy, policy, sizeof(RetryPolicyType));
+	if (gPolicy.attempts < 1)
+	{
+		gPolicy.attempts = 1;
+	}
+	if (gPolicy.attempts > ATTEMPTS_MAX)
+	{
+		gPolicy.attempts = ATTEMPTS_MAX;
+	}
+	if (gPolicy.backoffUs < 0)
+	{
+		gPolicy.backoffUs = 0;
+	}
+	if (gPolicy.backoffUs > BACKOFF_LIMIT_US)
+	{
+		gPolicy.backoffUs = BACKOFF_LIMIT_US;
+	}
+	if (gPolicy.backoffMaxUs > BACKOFF_LIMIT_US)
+	{
+		gPolicy.backoffMaxUs = BACKOFF_LIMIT_US;
+	}
+	if (gPolicy.backoffMaxUs < gPolicy.backoffUs)
+	{
+		gPolicy.backoffMaxUs = gPolicy.backoffUs;
+	}
+}
+
+const RetryPolicyType* retryPolicyGet(void)
+{
+	return &gPolicy;
+}
+
+int retryVerifyParse(const char *name)
+{
+	int i;
+
+	for (i = 0; i < VERIFY_COUNT; i++)
+	{
+		if (strcasecmp(name, verifyNames[i]) == 0)
+		{
+			return i;
+		}
+	}
+	return ERROR;
+}
+
+const char* retryVerifyName(VerifyModeType mode)
+{
+	if (mode >= VERIFY_COUNT)
+	{
+		return "?";
+	}
+	return verifyNames[mode];
+}
+
+RetryErrType retryLastError(void)
+{
+	return gLastErr;
+}
+
+const char* retryErrName(RetryErrType err)
+{
+	switch (err)
+	{
+	case RETRY_ERR_NONE:
+		return "ok";
+	case RETRY_ERR_NACK:
+		return "no acknowledge";
+	case RETRY_ERR_BUS:
+		return "bus error";
+	case RETRY_ERR_MISMATCH:
+		return "read back mismatch";
+	default:
+		break;
+	}
+	return "invalid request";
+}
+
+static RetryErrType commErr(void)
+{
+	switch (i2cLastError())
+	{
+	case I2C_ERR_NACK:
+		return RETRY_ERR_NACK;
+	case I2C_ERR_BUS:
+		return RETRY_ERR_BUS;
+	default:
+		break;
+	}
+	return RETRY_ERR_FATAL;
+}
+
+static void backoff(int *us)
+{
+	struct timespec ts;
+
+	if (*us <= 0)
+	{
+		return;
+	}
+	ts.tv_sec = *us / 1000000;
+	ts.tv_nsec = (long)(*us % 1000000) * 1000;
+	nanosleep(&ts, NULL);
+	*us *= 2;
+	if (*us > gPolicy.backoffMaxUs)
+	{
+		*us = gPolicy.backoffMaxUs;
+	}
+}
+
+/*
+ * verifyOp:
+ *	Return OK, RETRY_MISMATCH, or FAIL with gLastErr set
+ */
+static int verifyOp(RetryOpType *op)
+{
+	int ret;
+
+	if (NULL == op->check)
+	{
+		return OK;
+	}
+	ret = op->check(op->dev, op->arg);
+	if (ret == RETRY_MISMATCH)
+	{
+		gLastErr = RETRY_ERR_MISMATCH;
+	}
+	else if (ret != OK)
+	{
+		gLastErr = commErr();
+		ret = FAIL;
+	}
+	return ret;
+}
+
+/*
+ * retryPass:
+ *	One round over the ops not done yet: with "write" set write them, and read
+ *	each one back right after unless the verification is VERIFY_END; without
+ *	it read back the written ones. FAIL on a fatal error only
+ */
+static int retryPass(RetryOpType *ops, int count, int write,
+	VerifyModeType verify)
+{
+	int i;
+	int ret;
+
+	for (i = 0; i < count; i++)
+	{
+		if (ops[i].done > 0)
+		{
+			continue;
+		}
+		if (write)
+		{
+			if (OK != ops[i].write(ops[i].dev, ops[i].arg))
+			{
+				gLastErr = commErr();
+				if (gLastErr == RETRY_ERR_FATAL)
+				{
+					return FAIL;
+				}
+				ops[i].done = 0;
+				continue;
+			}
+			ops[i].done = -1;
+			if (verify == VERIFY_END)
+			{
+				continue;
+			}
+		}
+		if (ops[i].done == 0)
+		{
+			continue; // the write failed in this round
+		}
+		ret = verify == VERIFY_NONE ? OK : verifyOp(&ops[i]);
+		if ( (ret == FAIL) && (gLastErr == RETRY_ERR_FATAL))
+		{
+			return FAIL;
+		}
+		ops[i].done = ret == OK ? 1 : 0;
+	}
+	return OK;
+}
+
+/*
+ * retryLoop:
+ *	Every write is issued at most gPolicy.attempts times, with an exponential
+ *	backoff before each retry, so the worst case duration is bounded. With
+ *	"written" set the first round only reads back, the caller already sent
+ *	the writes
+ */
+static int retryLoop(RetryOpType *ops, int count, int written,
+	VerifyModeType verify)
+{
+	int i;
+	int attempt;
+	int pending = count;
+	int delay = gPolicy.backoffUs;
+
+	gLastErr = RETRY_ERR_NONE;
+	for (i = 0; i < count; i++)
+	{
+		ops[i].done = written ? -1 : 0;
+	}
+	for (attempt = 0; (attempt < gPolicy.attempts) && (pending > 0); attempt++)
+	{
+		if (attempt > 0)
+		{
+			backoff(&delay);
+		}
+		if ( (!written || (attempt > 0))
+			&& (OK != retryPass(ops, count, 1, verify)))
+		{
+			return FAIL;
+		}
+		if ( ( (written && (attempt == 0)) || (verify == VERIFY_END))
+			&& (OK != retryPass(ops, count, 0, verify)))
+		{
+			return FAIL;
+		}
+		for (i = 0, pending = 0; i < count; i++)
+		{
+			pending += ops[i].done <= 0;
+		}
+	}
+	if (pending > 0)
+	{
+		return FAIL;
+	}
+	gLastErr = RETRY_ERR_NONE;
+	return OK;
+}
+
+/*
+ * retryDefer:
+ *	Keep copies of written ops for the read back of retryFlush(). A board
+ *	already waiting is read back first, so a later write to it can not fail
+ *	the check of an earlier one
+ */
+static int retryDefer(RetryOpType *ops, int count)
+{
+	int i;
+	int j;
+
+	for (i = 0; i < count; i++)
+	{
+		if ( (ops[i].size < 0) || (ops[i].size > RETRY_ARG_MAX)
+			|| (count > RETRY_DEFER_MAX))
+		{
+			return retryLoop(ops, count, 1, gPolicy.verify);
+		}
+	}
+	for (i = 0; i < count; i++)
+	{
+		for (j = 0; j < gDeferred; j++)
+		{
+			if (gDeferOp[j].dev == ops[i].dev)
+			{
+				break;
+			}
+		}
+		if ( (j < gDeferred) || (gDeferred + count > RETRY_DEFER_MAX))
+		{
+			retryFlush();
+		}
+	}
+	for (i = 0; i < count; i++)
+	{
+		memcpy(&gDeferOp[gDeferred], &ops[i], sizeof(RetryOpType));
+		memcpy(gDeferArg[gDeferred], ops[i].arg, ops[i].size);
+		gDeferOp[gDeferred].arg = gDeferArg[gDeferred];
+		gDeferred++;
+	}
+	return OK;
+}
+
+/*
+ * retryRun:
+ *	Execute "count" writes according to the current policy. With VERIFY_END
+ *	all the writes of a round are read back in one pass after them, and
+ *	inside retryDeferBegin() / retryDeferEnd() that pass is postponed to the
+ *	next retryFlush().
+ *	Return OK when all the writes are done (and verified), FAIL otherwise,
+ *	retryLastError() tells why
+ */
+int retryRun(RetryOpType *ops, int count)
+{
+	if ( (gPolicy.verify != VERIFY_END) || !gDefer)
+	{
+		return retryLoop(ops, count, 0, gPolicy.verify);
+	}
+	if (OK != retryLoop(ops, count, 0, VERIFY_NONE))
+	{
+		return FAIL;
+	}
+	return retryDefer(ops, count);
+}
+
+/*
+ * retryCheck:
+ *	The caller already sent the writes of "ops" together (one I2C_RDWR
+ *	transfer): read them all back in one pass, unless the verification is
+ *	off, then rewrite and read back the failed ones within the policy. The
+ *	pass is deferred like the ones of retryRun()
+ */
+int retryCheck(RetryOpType *ops, int count)
+{
+	if ( (gPolicy.verify == VERIFY_END) && gDefer)
+	{
+		return retryDefer(ops, count);
+	}
+	return retryLoop(ops, count, 1, gPolicy.verify);
+}
+
+/*
+ * retryDeferBegin / retryFlush / retryDeferEnd:
+ *	Batch the VERIFY_END read backs of many retryRun() calls. retryFlush()
+ *	reads back the writes deferred so far, it must be called before the
+ *	boards are closed; retryDeferEnd() flushes and returns FAIL if any
+ *	deferred write failed since retryDeferBegin()
+ */
+void retryDeferBegin(void)
+{
+	gDefer = 1;
+	gDeferred = 0;
+	gDeferErr = RETRY_ERR_NONE;
+}
+
+int retryFlush(void)
+{
+	int count = gDeferred;
+
+	if (count == 0)
+	{
+		return OK;
+	}
+	gDeferred = 0;
+	if (OK != retryLoop(gDeferOp, count, 1, gPolicy.verify))
+	{
+		if (gDeferErr == RETRY_ERR_NONE)
+		{
+			gDeferErr = gLastErr;
+		}
+		return FAIL;
+	}
+	return OK;
+}
+
+int retryDeferEnd(void)
+{
+	retryFlush();
+	gDefer = 0;
+	gLastErr = gDeferErr;
+	return gDeferErr == RETRY_ERR_NONE ? OK : FAIL;
+}
@@ -0,0 +1,62 @@
+#ifndef RETRY_H_
+#define RETRY_H_
+
+typedef enum
+{
+	VERIFY_NONE = 0, // write only, retry on communication errors
+	VERIFY_EACH, // read back after every write
+	VERIFY_END, // write everything, then one read back pass
+	VERIFY_COUNT
+} VerifyModeType;
+
+typedef struct
+{
+	VerifyModeType verify;
+	int attempts; // max writes of the same value
+	int backoffUs; // delay before the first retry, doubled on every retry
+	int backoffMaxUs;
+} RetryPolicyType;
+
+// Why the last retryRun() failed
+
+typedef enum
+{
+	RETRY_ERR_NONE = 0,
+	RETRY_ERR_NACK,
+	RETRY_ERR_BUS,
+	RETRY_ERR_MISMATCH,
+	RETRY_ERR_FATAL
+} RetryErrType;
+
+/*
+ * One verified write on board "dev": "write" puts the value on the board,
+ * "check" read it back and return OK if it matches, RETRY_MISMATCH if not or
+ * FAIL on communication error. "size" is the size of *arg, copied when the
+ * read back is deferred
+ */
+#define RETRY_MISMATCH	1
+#define RETRY_ARG_MAX	32
+
+typedef struct
+{
+	int (*write)(int dev, const void *arg);
+	int (*check)(int dev, const void *arg);
+	const void *arg;
+	int size;
+	int dev;
+	int done; // 0 to write, -1 written, to read back, 1 done
+} RetryOpType;
+
+void retryPolicySet(const RetryPolicyType *policy);
+const RetryPolicyType* retryPolicyGet(void);
+int retryVerifyParse(const char *name);
+const char* retryVerifyName(VerifyModeType mode);
+int retryRun(RetryOpType *ops, int count);
+int retryCheck(RetryOpType *ops, int count);
+void retryDeferBegin(void);
+int retryFlush(void);
+int retryDeferEnd(void);
+RetryErrType retryLastError(void);
+const char* retryErrName(RetryErrType err);
+
+#endif //RETRY_H_
@@ -0,0 +1,363 @@
+/*
+ * telemetry.c:
+ *	Fixed rate sampling of the boards: the sampling loop puts the records in
+ *	a lock-free single producer / single consumer ring, a writer thread
+ *	drains it to a CSV or binary file, so the file I/O never delays a tick
+ *
+ *	Copyright (c) 2016-2023 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ *	Author: Alexandru Burcea
+ ***********************************************************************
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/fsuid.h>
+
+#include "mosfet.h"
+#include "thread.h"
+#include "telemetry.h"
+
+#define TELEMETRY_LEAD_US	1000	/* first tick after the start */
+#define TELEMETRY_DRAIN_US	10000	/* writer sleep when the ring is empty */
+
+static volatile sig_atomic_t gStop = 0;
+
+/*
+ * The sampler owns "head", the writer owns "tail"; each one only reads the
+ * other index, with acquire ordering, so a slot is never used by both
+ */
+static struct
+{
+	TelemetryRecordType rec[TELEMETRY_RING_SIZE];
+	atomic_uint head;
+	atomic_uint tail;
+	atomic_int done; // the sampler ended, drain and exit
+	atomic_int failed; // a file write failed, the writer exited
+	atomic_ulong written;
+	FILE *f;
+	int binary;
+	uint64_t startNs;
+} gRing;
+
+static void telemetrySignal(int sig)
+{
+	(void)sig;
+	gStop = 1;
+}
+
+static long long tsDiffNs(const struct timespec *a, const struct timespec *b)
+{
+	return (long long)(a->tv_sec - b->tv_sec) * 1000000000LL
+		+ (a->tv_nsec - b->tv_nsec);
+}
+
+static int ringPush(const TelemetryRecordType *rec)
+{
+	unsigned head = atomic_load_explicit(&gRing.head, memory_order_relaxed);
+
+	if (head - atomic_load_explicit(&gRing.tail, memory_order_acquire)
+		>= TELEMETRY_RING_SIZE)
+	{
+		return FAIL;
+	}
+	gRing.rec[head & (TELEMETRY_RING_SIZE - 1)] = *rec;
+	atomic_store_explicit(&gRing.head, head + 1, memory_order_release);
+	return OK;
+}
+
+static int recordWrite(const TelemetryRecordType *rec)
+{
+	uint64_t ns = gRing.startNs + rec->timeNs;
+
+	if (gRing.binary)
+	{
+		return fwrite(rec, sizeof(TelemetryRecordType), 1, gRing.f) == 1 ? OK : FAIL;
+	}
+	if (rec->flags & TELEMETRY_FLAG_ERROR)
+	{
+		return fprintf(gRing.f, "%lu,%llu.%06llu,%d,,,,err\n", (unsigned long)rec->tick,
+			(unsigned long long)(ns / 1000000000ULL),
+			(unsigned long long)(ns % 1000000000ULL / 1000), rec->stack) < 0 ? FAIL : OK;
+	}
+	if (rec->flags & TELEMETRY_FLAG_EXTENDED)
+	{
+		return fprintf(gRing.f, "%lu,%llu.%06llu,%d,%d,%d,%d,ok\n", (unsigned long)rec->tick,
+			(unsigned long long)(ns / 1000000000ULL),
+			(unsigned long long)(ns % 1000000000ULL / 1000), rec->stack, rec->mosfets,
+			rec->diag3v3mV, rec->temperature) < 0 ? FAIL : OK;
+	}
+	return fprintf(gRing.f, "%lu,%llu.%06llu,%d,%d,,,ok\n", (unsigned long)rec->tick,
+		(unsigned long long)(ns / 1000000000ULL),
+		(unsigned long long)(ns % 1000000000ULL / 1000), rec->stack,
+		rec->mosfets) < 0 ? FAIL : OK;
+}
+
+/*
+ * telemetryWriter:
+ *	Drain the ring to the file, flush after every batch so a reader of the
+ *	file or of the pipe sees the samples with at most one drain period delay
+ */
+static void* telemetryWriter(void *arg)
+{
+	struct timespec idle = {0, TELEMETRY_DRAIN_US * 1000L};
+	unsigned tail;
+	unsigned head;
+	int done;
+
+	(void)arg;
+	tail = atomic_load_explicit(&gRing.tail, memory_order_relaxed);
+	for (;;)
+	{
+		done = atomic_load_explicit(&gRing.done, memory_order_acquire);
+		head = atomic_load_explicit(&gRing.head, memory_order_acquire);
+		if (head == tail)
+		{
+			if (done)
+			{
+				break;
+			}
+			nanosleep(&idle, NULL);
+			continue;
+		}
+		for (; tail != head; tail++)
+		{
+			if (OK != recordWrite(&gRing.rec[tail & (TELEMETRY_RING_SIZE - 1)]))
+			{
+				atomic_store(&gRing.failed, 1);
+				return NULL;
+			}
+			atomic_store_explicit(&gRing.tail, tail + 1, memory_order_release);
+			atomic_fetch_add_explicit(&gRing.written, 1, memory_order_relaxed);
+		}
+		if (0 != fflush(gRing.f))
+		{
+			atomic_store(&gRing.failed, 1);
+			return NULL;
+		}
+	}
+	return NULL;
+}
+
+static int headerWrite(const TelemetryConfigType *cfg)
+{
+	TelemetryHeaderType hdr;
+
+	if (!cfg->binary)
+	{
+		return fprintf(gRing.f, "# 8mosind telemetry, period %lu us\n"
+			"tick,time,stack,mosfets,3v3_mV,temperature_C,status\n",
+			(unsigned long)cfg->periodUs) < 0 ? FAIL : OK;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TELEMETRY_MAGIC, 4);
+	hdr.version = TELEMETRY_VERSION;
+	hdr.recordSize = sizeof(TelemetryRecordType);
+	hdr.startNs = gRing.startNs;
+	hdr.periodUs = cfg->periodUs;
+	hdr.boards = cfg->boards;
+	return fwrite(&hdr, sizeof(hdr), 1, gRing.f) == 1 ? OK : FAIL;
+}
+
+/*
+ * telemetrySampleLoop:
+ *	Read every board at start + tick * period; the deadlines are absolute, a
+ *	tick that would start more than one period late is skipped and counted
+ */
+static void telemetrySampleLoop(const TelemetryConfigType *cfg,
+	TelemetrySampleType sample, const struct timespec *start,
+	TelemetryStatsType *stats)
+{
+	TelemetryRecordType rec;
+	struct timespec deadline;
+	struct timespec now;
+	long long late;
+	uint32_t tick = 0;
+	uint32_t skip;
+	int i;
+
+	while (!gStop && !atomic_load_explicit(&gRing.failed, memory_order_relaxed))
+	{
+		if ( (cfg->durationUs > 0)
+			&& ((long long)tick * cfg->periodUs >= cfg->durationUs))
+		{
+			break;
+		}
+		deadline = *start;
+		deadlineAdd(&deadline, (long long)tick * cfg->periodUs);
+		deadlineNow(&now);
+		late = tsDiffNs(&now, &deadline);
+		if (late > (long long)cfg->periodUs * 1000)
+		{
+			skip = (uint32_t)(tsDiffNs(&now, start) / ((long long)cfg->periodUs * 1000)) + 1;
+			stats->missed += skip - tick;
+			tick = skip;
+			continue;
+		}
+		while ( (late < 0) && (waitUntil(&deadline) < 0) && !gStop)
+			;
+		if (gStop)
+		{
+			break;
+		}
+		for (i = 0; i < STACK_LEVELS; i++)
+		{
+			if ( (cfg->boards & (1 << i)) == 0)
+			{
+				continue;
+			}
+			memset(&rec, 0, sizeof(rec));
+			deadlineNow(&now);
+			rec.timeNs = (uint64_t)tsDiffNs(&now, start);
+			rec.tick = tick;
+			rec.stack = (uint8_t)i;
+			if (OK != sample(i, &rec))
+			{
+				rec.flags = TELEMETRY_FLAG_ERROR;
+				stats->errors++;
+			}
+			stats->samples++;
+			if (OK != ringPush(&rec))
+			{
+				stats->dropped++;
+			}
+		}
+		stats->ticks++;
+		tick++;
+	}
+}
+
+/*
+ * telemetryOpen:
+ *	Create the output file with the permissions of the real user, so the
+ *	setuid binary can not be used to overwrite a file of root; a symbolic
+ *	link is refused
+ */
+static FILE *telemetryOpen(const char *path)
+{
+	uid_t uid = setfsuid(getuid());
+	gid_t gid = setfsgid(getgid());
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+		0644);
+	FILE *f = NULL;
+
+	setfsgid(gid);
+	setfsuid(uid);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+	f = fdopen(fd, "w");
+	if (NULL == f)
+	{
+		close(fd);
+	}
+	return f;
+}
+
+/*
+ * telemetryRun:
+ *	Sample the boards of cfg->boards until the duration ends or SIGINT/SIGTERM.
+ *	The writer thread runs with the default scheduling, also when the sampler
+ *	has the MOSIND_RT_* real-time settings
+ */
+int telemetryRun(const TelemetryConfigType *cfg, TelemetrySampleType sample,
+	TelemetryStatsType *stats)
+{
+	struct sigaction sa;
+	struct sigaction oldInt;
+	struct sigaction oldTerm;
+	struct sched_param param;
+	struct timespec start;
+	struct timespec real;
+	struct timespec now;
+	pthread_attr_t attr;
+	pthread_t writer;
+	int toStdout = strcmp(cfg->path, "-") == 0;
+
+	memset(stats, 0, sizeof(TelemetryStatsType));
+	if ( (cfg->boards == 0) || (cfg->periodUs == 0) || (NULL == sample))
+	{
+		return ERROR;
+	}
+	memset(&gRing, 0, sizeof(gRing)); // also prefaults the ring
+	gRing.binary = cfg->binary;
+	gRing.f = toStdout ? stdout : telemetryOpen(cfg->path);
+	if (NULL == gRing.f)
+	{
+		printf("Fail to open \"%s\"\n", cfg->path);
+		return ERROR;
+	}
+	deadlineNow(&start);
+	clock_gettime(CLOCK_REALTIME, &real);
+	deadlineAdd(&start, TELEMETRY_LEAD_US);
+	gRing.startNs = (uint64_t)real.tv_sec * 1000000000ULL + real.tv_nsec
+		+ TELEMETRY_LEAD_US * 1000ULL;
+	if (OK != headerWrite(cfg))
+	{
+		printf("Fail to write \"%s\"\n", cfg->path);
+		if (!toStdout)
+		{
+			fclose(gRing.f);
+		}
+		return ERROR;
+	}
+	memset(&param, 0, sizeof(param));
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	pthread_attr_setschedparam(&attr, &param);
+	if (0 != pthread_create(&writer, &attr, &telemetryWriter, NULL))
+	{
+		pthread_attr_destroy(&attr);
+		printf("Fail to start the writer thread\n");
+		if (!toStdout)
+		{
+			fclose(gRing.f);
+		}
+		return ERROR;
+	}
+	pthread_attr_destroy(&attr);
+
+	gStop = 0;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = telemetrySignal; // no SA_RESTART, the sleep must be interrupted
+	sigaction(SIGINT, &sa, &oldInt);
+	sigaction(SIGTERM, &sa, &oldTerm);
+	telemetrySampleLoop(cfg, sample, &start, stats);
+	deadlineNow(&now);
+	stats->elapsedNs = tsDiffNs(&now, &start);
+	sigaction(SIGINT, &oldInt, NULL);
+	sigaction(SIGTERM, &oldTerm, NULL);
+
+	atomic_store_explicit(&gRing.done, 1, memory_order_release);
+	pthread_join(writer, NULL);
+	stats->written = atomic_load(&gRing.written);
+	stats->writeFailed = atomic_load(&gRing.failed);
+	if (toStdout)
+	{
+		fflush(stdout);
+	}
+	else if (0 != fclose(gRing.f))
+	{
+		stats->writeFailed = 1;
+	}
+	return stats->writeFailed ? FAIL : OK;
+}
+
+void telemetryReport(const TelemetryStatsType *stats, FILE *out)
+{
+	fprintf(out, "%lu ticks, %lu samples in %.3f s, %lu written, %lu dropped, "
+		"%lu ticks missed, %lu read errors%s\n", stats->ticks, stats->samples,
+		stats->elapsedNs / 1e9, stats->written, stats->dropped, stats->missed,
+		stats->errors, stats->writeFailed ? ", write failed" : "");
+}
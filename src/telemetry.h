@@ -0,0 +1,73 @@
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Binary telemetry file, little endian: one header followed by the records
+ * in the order they were sampled
+ */
+#define TELEMETRY_MAGIC		"8MTL"
+#define TELEMETRY_VERSION	1
+
+#define TELEMETRY_RING_SIZE	4096	/* records, power of two */
+
+#define TELEMETRY_FLAG_EXTENDED	1	/* the diagnostics fields are valid */
+#define TELEMETRY_FLAG_ERROR	2	/* the board read failed, only the time is valid */
+
+// naturally aligned, no padding
+
+typedef struct
+{
+	char magic[4];
+	uint16_t version;
+	uint16_t recordSize;
+	uint64_t startNs; // CLOCK_REALTIME of the tick 0, ns from the epoch
+	uint32_t periodUs;
+	uint8_t boards; // bit n set if stack level n is sampled
+	uint8_t reserved[3];
+} TelemetryHeaderType;
+
+typedef struct
+{
+	uint64_t timeNs; // read start, from the tick 0
+	uint32_t tick; // the records of one tick share it, a gap is a missed tick
+	uint8_t stack;
+	uint8_t flags;
+	uint8_t mosfets; // bit 0 = mosfet 1
+	int8_t temperature; // C
+	uint16_t diag3v3mV;
+	uint16_t reserved;
+	uint32_t reserved2;
+} TelemetryRecordType;
+
+typedef struct
+{
+	uint8_t boards; // bit n = stack level n
+	uint32_t periodUs;
+	long long durationUs; // 0 = until SIGINT/SIGTERM
+	const char *path; // "-" for stdout
+	int binary; // 0 CSV, 1 binary records
+} TelemetryConfigType;
+
+typedef struct
+{
+	unsigned long ticks;
+	unsigned long samples; // records produced
+	unsigned long written;
+	unsigned long dropped; // ring full, the writer fell behind
+	unsigned long missed; // ticks skipped, the sampler fell behind
+	unsigned long errors; // failed board reads
+	long long elapsedNs;
+	int writeFailed;
+} TelemetryStatsType;
+
+// read one board, fill the fields after "tick", return OK or FAIL
+typedef int (*TelemetrySampleType)(int stack, TelemetryRecordType *rec);
+
+int telemetryRun(const TelemetryConfigType *cfg, TelemetrySampleType sample,
+	TelemetryStatsType *stats);
+void telemetryReport(const TelemetryStatsType *stats, FILE *out);
+
+#endif //TELEMETRY_H_
@@ -1,7 +1,15 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <malloc.h>
 #include <termios.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "thread.h"
 
@@ -92,17 +100,179 @@ int checkThreadResult(void)
 }
 
 /*
- * busyWait:
- *	Wait for some number of milliseconds
+ * deadlineNow / deadlineAdd:
+ *	Absolute CLOCK_MONOTONIC deadlines, a periodic loop adds its period to the
+ *	previous deadline instead of sleeping a relative time, so the time spent
+ *	working and waking up does not accumulate as drift
  *********************************************************************************
  */
 
-void busyWait(int ms)
+void deadlineNow (struct timespec *ts)
 {
-  struct timespec sleeper, dummy ;
+  clock_gettime (CLOCK_MONOTONIC, ts) ;
+}
+
+void deadlineAdd (struct timespec *ts, long long us)
+{
+  long long ns = ts->tv_nsec + (us % 1000000) * 1000 ;
+
+  ts->tv_sec += (time_t)(us / 1000000) + (time_t)(ns / 1000000000) ;
+  ts->tv_nsec = (long)(ns % 1000000000) ;
+  if (ts->tv_nsec < 0)
+  {
+    ts->tv_sec-- ;
+    ts->tv_nsec += 1000000000 ;
+  }
+}
+
+/*
+ * waitUntil:
+ *	Sleep until the absolute deadline, return at once if it is already past.
+ *	Return -1 if a signal interrupted the wait
+ *********************************************************************************
+ */
+
+int waitUntil (const struct timespec *deadline)
+{
+  int ret = clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) ;
+
+  return ret == 0 ? 0 : -1 ;
+}
+
+/*
+ * rtCpuParse:
+ *	Translate a cpu list like "3" or "2,3" or "0-1,3" to a mask
+ *********************************************************************************
+ */
+
+int rtCpuParse (const char *list, unsigned long long *mask)
+{
+  char *end = NULL ;
+  long first, last ;
+
+  *mask = 0 ;
+  while (*list != 0)
+  {
+    first = strtol (list, &end, 10) ;
+    if ((end == list) || (first < 0) || (first >= RT_CPU_MAX))
+      return -1 ;
+    last = first ;
+    if (*end == '-')
+    {
+      list = end + 1 ;
+      last = strtol (list, &end, 10) ;
+      if ((end == list) || (last < first) || (last >= RT_CPU_MAX))
+        return -1 ;
+    }
+    for (; first <= last; first++)
+      *mask |= 1ULL << first ;
+    if (*end == ',')
+      end++ ;
+    else if (*end != 0)
+      return -1 ;
+    list = end ;
+  }
+  return *mask == 0 ? -1 : 0 ;
+}
+
+/*
+ * rtPrefaultStack:
+ *	Touch the stack the I/O path may use, so the pages are mapped (and locked
+ *	by mlockall) before the first deadline instead of faulting in on it.
+ *	One volatile store per page, in a function of its own: the compiler can
+ *	neither drop the stores nor the frame
+ *********************************************************************************
+ */
+
+static __attribute__((noinline)) void rtPrefaultStack (void)
+{
+  UNU volatile unsigned char stack [RT_STACK_PREFAULT] ;
+  long page = sysconf (_SC_PAGESIZE) ;
+  long i ;
+
+  if (page <= 0)
+    page = 4096 ;
+  for (i = 0; i < RT_STACK_PREFAULT; i += page)
+    stack [i] = 0 ;
+  stack [RT_STACK_PREFAULT - 1] = 0 ;
+}
+
+/*
+ * rtApply:
+ *	Configure the calling thread, the one that talks to the hardware:
+ *	SCHED_FIFO priority, cpu affinity, locked and prefaulted memory.
+ *	Print the failing step and return -1 on error
+ *********************************************************************************
+ */
 
-  sleeper.tv_sec  = (time_t)(ms / 1000) ;
-  sleeper.tv_nsec = (long)(ms % 1000) * 1000000 ;
+int rtApply (const RtConfigType *cfg)
+{
+  struct sched_param sched ;
+  cpu_set_t set ;
+  int i, ret ;
+
+  if (cfg->lockMemory)
+  {
+    // keep freed heap and large allocations inside the locked area
+    mallopt (M_TRIM_THRESHOLD, -1) ;
+    mallopt (M_MMAP_MAX, 0) ;
+    if (mlockall (MCL_CURRENT | MCL_FUTURE) < 0)
+    {
+      printf ("Fail to lock the memory: %s\n", strerror (errno)) ;
+      return -1 ;
+    }
+    rtPrefaultStack () ;
+  }
+  if (cfg->cpuMask != 0)
+  {
+    CPU_ZERO (&set) ;
+    for (i = 0; i < RT_CPU_MAX; i++)
+      if (cfg->cpuMask & (1ULL << i))
+        CPU_SET (i, &set) ;
+    ret = pthread_setaffinity_np (pthread_self (), sizeof (set), &set) ;
+    if (ret != 0)
+    {
+      printf ("Fail to set the cpu affinity: %s\n", strerror (ret)) ;
+      return -1 ;
+    }
+  }
+  if (cfg->priority > 0)
+  {
+    memset (&sched, 0, sizeof (sched)) ;
+    sched.sched_priority = cfg->priority > sched_get_priority_max (SCHED_FIFO) ?
+      sched_get_priority_max (SCHED_FIFO) : cfg->priority ;
+    ret = pthread_setschedparam (pthread_self (), SCHED_FIFO, &sched) ;
+    if (ret != 0)
+    {
+      printf ("Fail to set SCHED_FIFO priority %d: %s\n", sched.sched_priority,
+        strerror (ret)) ;
+      return -1 ;
+    }
+  }
+  return 0 ;
+}
+
+/*
+ * rtDescribe:
+ *	One line with the scheduling of the calling thread, for the reports
+ *********************************************************************************
+ */
+
+void rtDescribe (char *buff, int size)
+{
+  struct sched_param sched ;
+  cpu_set_t set ;
+  int policy = SCHED_OTHER ;
+  int len, i ;
 
-  nanosleep (&sleeper, &dummy) ;
+  pthread_getschedparam (pthread_self (), &policy, &sched) ;
+  len = snprintf (buff, size, "%s priority %d, cpus",
+    policy == SCHED_FIFO ? "SCHED_FIFO" : (policy == SCHED_RR ? "SCHED_RR" : "SCHED_OTHER"),
+    policy == SCHED_OTHER ? 0 : sched.sched_priority) ;
+  if ((len < size) && (pthread_getaffinity_np (pthread_self (), sizeof (set), &set) == 0))
+  {
+    for (i = 0; (i < CPU_SETSIZE) && (len < size); i++)
+      if (CPU_ISSET (i, &set))
+        len += snprintf (buff + len, size - len, " %d", i) ;
+  }
 }
@@ -1,6 +1,8 @@
 #ifndef _THREAD_H_
 #define _THREAD_H_
 
+#include <time.h>
+
 #define	COUNT_KEY	0
 #define YES		1
 #define NO		2
@@ -9,7 +11,23 @@
 #define	PI_THREAD(X)	void *X (UNU void *dummy)
 
 
-void busyWait(int ms);
+#define RT_CPU_MAX			64
+#define RT_STACK_PREFAULT	(256 * 1024)
+
+typedef struct
+{
+	int priority; // SCHED_FIFO priority, 0 keep the default scheduling
+	unsigned long long cpuMask; // bit n = cpu n, 0 any cpu
+	int lockMemory; // mlockall and prefault the stack
+} RtConfigType;
+
+int rtCpuParse(const char *list, unsigned long long *mask);
+int rtApply(const RtConfigType *cfg);
+void rtDescribe(char *buff, int size);
+
+void deadlineNow(struct timespec *ts);
+void deadlineAdd(struct timespec *ts, long long us);
+int waitUntil(const struct timespec *deadline);
 void startThread(void);
 int checkThreadResult(void);
 
@@ -0,0 +1,83 @@
+#!/bin/sh
+#
+# emu.sh:
+#	Run the command line against the board emulator, for CI without a card
+#	Usage: tests/emu.sh [<8mosind binary>]
+#
+BIN=${1:-./8mosind}
+IMG=$(mktemp /tmp/8mosind-emu.XXXXXX) || exit 1
+trap 'rm -f "$IMG"' EXIT
+
+export MOSIND_BACKEND=emu
+export MOSIND_EMU_BOARDS=0,1a,2x
+export MOSIND_EMU_FILE=$IMG
+export MOSIND_CACHE_DIR=
+unset MOSIND_GROUPS MOSIND_VERIFY MOSIND_EMU_NACK_PCT MOSIND_EMU_STUCK_HI MOSIND_EMU_STUCK_LO
+
+FAIL=0
+
+# check <expected output> <arguments..>
+check()
+{
+	want=$1
+	shift
+	got=$("$BIN" "$@" 2>&1)
+	if [ "$got" = "$want" ]; then
+		echo "ok   8mosind $*"
+	else
+		echo "FAIL 8mosind $*"
+		echo "     expected: $want"
+		echo "     got:      $got"
+		FAIL=1
+	fi
+}
+
+# run <arguments..>: only the exit status is checked
+run()
+{
+	if "$BIN" "$@" > /dev/null 2>&1; then
+		echo "ok   8mosind $*"
+	else
+		echo "FAIL 8mosind $*"
+		FAIL=1
+	fi
+}
+
+: > "$IMG"
+check "3 board(s) detected
+Id: 2 1 0
+Stack 0: 0x3f primary, hw 5.0, fw 1.2
+Stack 1: 0x26 alternate, hw 5.0, fw 1.2
+Stack 2: 0x3d primary, I/O expander" -list
+check "" 0 write 165
+check "165" 0 read
+check "" 0 write 2 on
+check "1" 0 read 2
+check "167" 0 read
+check "" 1 pwmwr all 10 20 30 40 50 60 70 80
+check "10.0 20.0 30.0 40.0 50.0 60.0 70.0 80.0" 1 pwmrd all
+check "30.0" 1 pwmrd 3
+check "" 1 fwr 200
+check "200" 1 frd
+run -sync 0:3 1:5
+check "3" 0 read
+check "5" 1 read
+check "" -mask set 9-10
+check "0x0000000000000703 1-2,9-11" -mask read 1-16
+check "" 2 write 7
+check "7" 2 read
+
+got=$(printf '0 write 0\n0 read\n1 write 255\n1 read\n' | "$BIN" -batch 2>&1)
+if [ "$got" = "$(printf '1: ok\n0\n2: ok\n3: ok\n255\n4: ok')" ]; then
+	echo "ok   8mosind -batch"
+else
+	echo "FAIL 8mosind -batch"
+	echo "     got: $got"
+	FAIL=1
+fi
+
+if [ $FAIL -ne 0 ]; then
+	echo "emulator tests failed"
+	exit 1
+fi
+echo "emulator tests passed"